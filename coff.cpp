@@ -1,174 +1,212 @@
 #include "coff.hpp"
 
-void generate_coff(std::ofstream &f, uint64_t bss_size) {
-	uint64_t strtab_size = 4;
-	for (auto &s : extern_labels) {
-		if (s.size() > 8)
-			strtab_size += s.size() + 1;
+// the same input gives the same bytes, the header only carries a date when SOURCE_DATE_EPOCH gives one
+static uint32_t coff_timestamp() {
+	const char *epoch = getenv("SOURCE_DATE_EPOCH");
+	uint32_t t = 0;
+	if (epoch)
+		std::from_chars(epoch, epoch + strlen(epoch), t);
+	return t;
+}
+
+// more relocations than the 16 bits of the header can count: the count, including this entry,
+// is in the address of an extra first relocation
+static bool reloc_overflow(const section_info &s) {
+	return s.relocs.size() >= 0xffff;
+}
+
+// characteristics of a section: its contents, access and alignment (1 to 8192 bytes)
+static uint32_t coff_flags(const section_info &s) {
+	uint32_t flags;
+	if (s.kind == TEXT)
+		flags = 0x60000020; // code, execute, read
+	else if (s.kind == BSS)
+		flags = 0xc0000080; // uninitialized data, read, write
+	else if (s.kind == DATA)
+		flags = 0xc0000040; // initialized data, read, write
+	else
+		flags = 0x40000040; // initialized data, read
+	if (reloc_overflow(s))
+		flags |= 0x01000000; // extended relocations
+	return flags | (std::countr_zero(std::min<uint32_t>(s.align, 8192)) + 1) << 20;
+}
+
+bool generate_coff(object_image &f) {
+	// list of symbols to include: the defined ones and the externs
+	size_t num_defined = 0;
+	size_t num_externs = 0;
+	for (const symbol &s : symbols) {
+		if (s.section == UNDEF && !s.external)
+			continue;
+		num_defined += s.section != UNDEF;
+		num_externs += s.section == UNDEF;
 	}
-	for (auto &s : labels) {
-		if (s.first.size() > 8)
-			strtab_size += s.first.size() + 1;
+	// index of each symbol in the symbol table: the defined ones, then the externs
+	std::vector<uint32_t> sym_index(symbols.size());
+	std::vector<uint32_t> ordered_syms(num_defined + num_externs);
+	uint32_t next_defined = 0, next_extern = num_defined;
+	for (uint32_t id = 0; id < symbols.size(); id++) {
+		const symbol &s = symbols[id];
+		if (s.section == UNDEF && !s.external)
+			continue;
+		uint32_t &next = s.section == UNDEF ? next_extern : next_defined;
+		sym_index[id] = next;
+		ordered_syms[next++] = id;
 	}
 
-	const size_t data_size = data_buffer.size();
-	const size_t rodata_size = rodata_buffer.size();
+	// number of each section, from 1, the numbers from 0xff00 on are reserved
+	const std::vector<uint32_t> written = written_sections();
+	if (written.size() >= 0xff00) {
+		std::cerr << "Erreur : trop de sections pour un fichier COFF (" << written.size() << ", 65279 au plus)" << std::endl;
+		return false;
+	}
+	std::vector<uint16_t> number(sections.size());
+	for (size_t i = 0; i < written.size(); i++)
+		number[written[i]] = i + 1;
+
+	// string table: names of more than 8 characters, of sections then of symbols
+	std::string strtab(4, '\0');
+	std::vector<uint32_t> name_offset(sections.size());
+	for (uint32_t id : written) {
+		if (sections[id].name.size() <= 8)
+			continue;
+		name_offset[id] = strtab.size();
+		strtab.append(sections[id].name.c_str(), sections[id].name.size() + 1);
+	}
+	const size_t symbol_names = strtab.size();
+	for (uint32_t id : ordered_syms) {
+		if (symbols[id].name.size() > 8)
+			strtab.append(symbols[id].name.c_str(), symbols[id].name.size() + 1);
+	}
+	const uint32_t strtab_size = strtab.size();
+	memcpy(strtab.data(), &strtab_size, 4);
 
 	// COFF header
 	coff_header chdr;
-	chdr.sections = 1 + !!data_size + !!rodata_size + !!bss_size;
-	chdr.timestamp = (uint32_t)time(NULL);
+	chdr.sections = written.size();
+	chdr.timestamp = coff_timestamp();
 	chdr.symtab_off = sizeof(chdr) + chdr.sections * sizeof(coff_section_header); // coff hdr + section headers
-	chdr.num_symbols = extern_labels.size() + labels.size();
+	chdr.num_symbols = ordered_syms.size();
+
+	// offsets of the sections in the file, each one followed by its relocations
+	std::vector<uint64_t> offset(sections.size());
+	uint64_t next_offset = chdr.symtab_off + chdr.num_symbols * sizeof(coff_symbol) + strtab_size;
+	for (uint32_t id : written) {
+		const section_info &s = sections[id];
+		if (s.kind == BSS)
+			continue;
+		offset[id] = next_offset;
+		next_offset += s.buffer.size() + (s.relocs.size() + reloc_overflow(s)) * sizeof(coff_relocation);
+	}
+	f.allocate(next_offset);
+
 	f.write((const char *)&chdr, sizeof(coff_header));
 
 	// section headers
-	// text section
 	coff_section_header shdr;
-	memcpy(shdr.name, ".text\0\0", 8);
-	shdr.vsize = text_buffer.size();
-	shdr.size = text_buffer.size();
-	shdr.offset = chdr.symtab_off + chdr.num_symbols * sizeof(coff_symbol) + strtab_size;
-	shdr.reloc_off = relocations.size() ? shdr.offset + shdr.size : 0;
-	shdr.num_relocs = relocations.size();
-	shdr.flags = 0x60500020; // code, execute, read, align 16
-	f.write((const char *)&shdr, sizeof(shdr));
-
-	size_t next_offset = (shdr.offset + shdr.size + shdr.num_relocs * sizeof(coff_relocation));
-
-	// data section
-	if (data_size) {
-		memcpy(shdr.name, ".data\0\0", 8);
-		shdr.vsize = data_size;
-		shdr.size = data_size;
-		shdr.offset = next_offset;
-		shdr.reloc_off = 0;
-		shdr.num_relocs = 0;
-		shdr.flags = 0xc0300040; // initialized data, read, write, align 4
-		f.write((const char *)&shdr, sizeof(shdr));
-
-		next_offset = shdr.offset + shdr.size;
-	}
-
-	// rodata section
-	if (rodata_size) {
-		memcpy(shdr.name, ".rodata", 8);
-		shdr.vsize = rodata_size;
-		shdr.size = rodata_size;
-		shdr.offset = next_offset;
-		shdr.reloc_off = 0;
-		shdr.num_relocs = 0;
-		shdr.flags = 0x40300040; // initialized data, read, align 4
-		f.write((const char *)&shdr, sizeof(shdr));
-
-		next_offset = shdr.offset + shdr.size;
-	}
-
-	// bss section
-	if (bss_size) {
-		memcpy(shdr.name, ".bss\0\0\0", 8);
-		shdr.vsize = bss_size;
-		shdr.size = 0;
-		shdr.offset = 0;
-		shdr.reloc_off = 0;
-		shdr.num_relocs = 0;
-		shdr.flags = 0xc0300080; // uninitialized data, read, write, align 4
+	for (uint32_t id : written) {
+		const section_info &s = sections[id];
+		memset(shdr.name, 0, 8);
+		if (s.name.size() <= 8) {
+			memcpy(shdr.name, s.name.data(), s.name.size());
+		} else {
+			// "/" and the offset of the name in the string table, in decimal
+			shdr.name[0] = '/';
+			std::to_chars(shdr.name + 1, shdr.name + 8, name_offset[id]);
+		}
+		if (s.kind == BSS) {
+			shdr.vsize = s.bss_size;
+			shdr.size = 0;
+			shdr.offset = 0;
+		} else {
+			shdr.vsize = s.buffer.size();
+			shdr.size = s.buffer.size();
+			shdr.offset = offset[id];
+		}
+		shdr.reloc_off = s.relocs.size() ? offset[id] + s.buffer.size() : 0;
+		shdr.num_relocs = reloc_overflow(s) ? 0xffff : s.relocs.size();
+		shdr.flags = coff_flags(s);
 		f.write((const char *)&shdr, sizeof(shdr));
 	}
 
-	// symbol table
-	coff_symbol sym;
-	uint32_t i = 4;
-	std::vector<std::string> ordered_syms;
-	for (auto &l : labels) {
-		if (l.first.size() <= 8) {
+	// symbol table, the names go to the string table built above
+	std::vector<coff_symbol> symtab(ordered_syms.size());
+	uint32_t i = symbol_names;
+	for (size_t n = 0; n < ordered_syms.size(); n++) {
+		const symbol &s = symbols[ordered_syms[n]];
+		coff_symbol &sym = symtab[n];
+		if (s.name.size() <= 8) {
 			memset(sym.name, 0, 8);
-			memcpy(sym.name, l.first.data(), l.first.size());
+			memcpy(sym.name, s.name.data(), s.name.size());
 		} else {
 			memset(sym.name, 0, 4);
 			memcpy(sym.name + 4, (const char *)&i, 4);
-			i += l.first.size() + 1;
+			i += s.name.size() + 1;
 		}
-		sym.val = l.second.second;
-		if (l.second.first == TEXT)
+		if (s.section == UNDEF) {
+			sym.val = 0;
+			sym.section = 0;
 			sym.storage_class = 2; // external
-		else
-			sym.storage_class = 3; // static
-
-		if (l.second.first == TEXT)
-			sym.section = 1;
-		else if (l.second.first == DATA)
-			sym.section = 2;
-		else if (l.second.first == RODATA)
-			sym.section = 2 + !!data_size;
-		else
-			sym.section = 2 + !!data_size + !!rodata_size;
-		ordered_syms.push_back(l.first);
-		f.write((const char *)&sym, sizeof(sym));
-	}
-	sym.storage_class = 5; // external
-	for (auto &l : extern_labels) {
-		if (l.size() <= 8) {
-			memset(sym.name, 0, 8);
-			memcpy(sym.name, l.data(), l.size());
 		} else {
-			memset(sym.name, 0, 4);
-			memcpy(sym.name + 4, (const char *)&i, 4);
-			i += l.size() + 1;
+			sym.val = s.offset;
+			if (s.section == TEXT)
+				sym.storage_class = 2; // external
+			else
+				sym.storage_class = 3; // static
+			sym.section = number[s.section_id];
 		}
-		sym.val = 0;
-		ordered_syms.push_back(l);
-		f.write((const char *)&sym, sizeof(sym));
 	}
+	f.write((const char *)symtab.data(), symtab.size() * sizeof(coff_symbol));
+	f.write(strtab.data(), strtab.size());
 
-	// string table
-	f.write((const char *)&strtab_size, 4);
-	for (auto &l : ordered_syms) {
-		if (l.size() <= 8)
+	std::vector<coff_relocation> rels;
+	for (uint32_t id : written) {
+		section_info &s = sections[id];
+		if (s.kind == BSS)
 			continue;
-		f.write(l.data(), l.size() + 1);
-	}
 
-	// relocation addends
-	for (auto &r : relocations) {
-		if (r.type == REL)
-			r.addend += 4;
-
-		if (r.size == 8) {
-			text_buffer[r.offset] = r.addend;
-		} else if (r.size == 16) {
-			*(int16_t *)(text_buffer.data() + r.offset) = r.addend;
-		} else if (r.size == 32) {
-			*(int32_t *)(text_buffer.data() + r.offset) = r.addend;
-		} else {
-			*(int64_t *)(text_buffer.data() + r.offset) = r.addend;
+		// relocation addends
+		for (auto &r : s.relocs) {
+			if (r.type == REL)
+				r.addend += 4;
+
+			if (r.size == 8) {
+				s.buffer[r.offset] = r.addend;
+			} else if (r.size == 16) {
+				*(int16_t *)(s.buffer.data() + r.offset) = r.addend;
+			} else if (r.size == 32) {
+				*(int32_t *)(s.buffer.data() + r.offset) = r.addend;
+			} else {
+				*(int64_t *)(s.buffer.data() + r.offset) = r.addend;
+			}
 		}
-	}
 
-	// text
-	f.write((const char *)text_buffer.data(), text_buffer.size());
-
-	// relocation table
-	coff_relocation rel;
-	for (auto &r : relocations) {
-		rel.vaddr = r.offset;
-		rel.sym = find(ordered_syms.begin(), ordered_syms.end(), r.symbol) - ordered_syms.begin();
-		if (r.type == ABS) {
-			rel.type = 2;
-		} else if (r.type == REL) {
-			rel.type = 4;
-		} else {
-			std::cerr << "avertissement : impossible de créer un réadressage vers PLT dans un fichier COFF" << std::endl;
-			rel.type = 0;
+		// contents
+		f.write(s.buffer.data(), s.buffer.size());
+
+		// relocation table
+		const size_t first = reloc_overflow(s);
+		rels.resize(s.relocs.size() + first);
+		if (first) {
+			rels[0].vaddr = rels.size();
+			rels[0].sym = 0;
+			rels[0].type = 0;
+		}
+		for (size_t n = 0; n < s.relocs.size(); n++) {
+			const reloc_entry &r = s.relocs[n];
+			coff_relocation &rel = rels[first + n];
+			rel.vaddr = r.offset;
+			rel.sym = sym_index[r.symbol];
+			if (r.type == ABS) {
+				rel.type = 2;
+			} else if (r.type == REL) {
+				rel.type = 4;
+			} else {
+				std::cerr << "avertissement : impossible de créer un réadressage vers PLT dans un fichier COFF" << std::endl;
+				rel.type = 0;
+			}
 		}
-		f.write((const char *)&rel, sizeof(rel));
+		f.write((const char *)rels.data(), rels.size() * sizeof(coff_relocation));
 	}
-
-	// data
-	f.write((const char *)data_buffer.data(), data_size);
-
-	// rodata
-	f.write((const char *)rodata_buffer.data(), rodata_size);
-
-	f.close();
+	return true;
 }
@@ -5,13 +5,10 @@
 #include "defines.hpp"
 #include "main.hpp"
 
-extern std::vector<std::string> extern_labels;
-extern std::unordered_set<std::string> global;
-extern std::vector<struct reloc_entry> relocations;
-extern std::unordered_map<std::string, std::pair<sect, size_t>> labels;
-extern std::string text_buffer;
-extern std::string data_buffer;
-extern std::string rodata_buffer;
+extern std::deque<symbol> symbols;
+extern std::vector<section_info> sections;
+
+std::vector<uint32_t> written_sections();
 
 struct coff_header {
 	uint16_t machine = 0x8664; // AMD64
@@ -51,6 +48,6 @@ struct coff_relocation {
 	uint16_t type;
 } __attribute__((packed));
 
-void generate_coff(std::ofstream &, uint64_t);
+bool generate_coff(object_image &);
 
 #endif
@@ -1,27 +1,75 @@
 #include "elf.hpp"
 
-void generate_elf(std::ofstream &f, uint64_t bss_size) {
+void generate_elf(object_image &f) {
 	// structure:
 	//  ELF header
 	//  section headers
-	//   text
-	//   data
-	//   bss
+	//   null
+	//   sections of the file, in the order they were created
 	//   shstrtab
 	//   symtab
 	//   strtab
-	//   rela.text
+	//   symtab_shndx when sections are numbered past SHN_LORESERVE
+	//   rela.<section> for each section with relocations
 	//  section data
 
-	// list of symbols to include
+	// list of symbols to include: the defined ones and the externs
 	uint64_t strtab_size = 1;
-	for (auto &s : extern_labels)
-		strtab_size += s.size() + 1;
-	for (auto &s : labels)
-		strtab_size += s.first.size() + 1;
+	size_t num_symbols = 0;
+	size_t num_locals = 0;
+	size_t num_externs = 0;
+	for (const symbol &s : symbols) {
+		if (s.section == UNDEF && !s.external)
+			continue;
+		strtab_size += s.name.size() + 1;
+		num_symbols++;
+		num_locals += s.section != UNDEF && !s.global;
+		num_externs += s.section == UNDEF;
+	}
+
+	// index of each section in the section header table, and the relocation tables that follow the metadata
+	const std::vector<uint32_t> written = written_sections();
+	std::vector<uint32_t> shndx(sections.size());
+	std::vector<uint32_t> relocated;
+	for (size_t i = 0; i < written.size(); i++) {
+		shndx[written[i]] = i + 1;
+		if (sections[written[i]].relocs.size())
+			relocated.push_back(written[i]);
+	}
+	const uint32_t shstrtab_index = written.size() + 1;
+	const uint32_t symtab_index = shstrtab_index + 1;
+	const uint32_t strtab_index = shstrtab_index + 2;
+	// with that many sections the symbols take their section index from a table of 32-bit entries,
+	// and the header keeps the section count and the index of shstrtab in the null section
+	const bool extended = written.size() >= SHN_LORESERVE;
+	const uint32_t shnum = strtab_index + 1 + extended + relocated.size();
 
-	const size_t data_size = data_buffer.size();
-	const size_t rodata_size = rodata_buffer.size();
+	// section names
+	std::string shstrtab(1, '\0');
+	std::vector<uint32_t> name_offset(sections.size());
+	std::vector<uint32_t> rela_name_offset(sections.size());
+	for (uint32_t id : written) {
+		name_offset[id] = shstrtab.size();
+		shstrtab += sections[id].name + '\0';
+	}
+	const uint32_t shstrtab_name = shstrtab.size();
+	shstrtab += ".shstrtab";
+	shstrtab += '\0';
+	const uint32_t symtab_name = shstrtab.size();
+	shstrtab += ".symtab";
+	shstrtab += '\0';
+	const uint32_t strtab_name = shstrtab.size();
+	shstrtab += ".strtab";
+	shstrtab += '\0';
+	const uint32_t symtab_shndx_name = shstrtab.size();
+	if (extended) {
+		shstrtab += ".symtab_shndx";
+		shstrtab += '\0';
+	}
+	for (uint32_t id : relocated) {
+		rela_name_offset[id] = shstrtab.size();
+		shstrtab += ".rela" + sections[id].name + '\0';
+	}
 
 	// ELF header
 	elf_header ehdr;
@@ -37,86 +85,65 @@ void generate_elf(std::ofstream &f, uint64_t bss_size) {
 	ehdr.phentsize = 0;
 	ehdr.phnum = 0;
 	ehdr.shentsize = sizeof(elf_section_header);
-	ehdr.shnum = 5 + !!data_size + !!rodata_size + !!bss_size + !!relocations.size(); // 5 for null, text, symtab, strtab, shstrtab
-	ehdr.shstrndx = 2 + !!data_size + !!rodata_size + !!bss_size; // first metadata section for shstrtab
+	ehdr.shnum = shnum < SHN_LORESERVE ? shnum : 0;
+	ehdr.shstrndx = shstrtab_index < SHN_LORESERVE ? shstrtab_index : SHN_XINDEX;
+
+	// offsets in the file, each section at its alignment
+	std::vector<uint64_t> offset(sections.size());
+	uint64_t next_offset = ehdr.shoff + (uint64_t)ehdr.shentsize * shnum;
+	for (uint32_t id : written) {
+		const section_info &s = sections[id];
+		if (s.kind == BSS)
+			continue;
+		offset[id] = (next_offset + s.align - 1) & ~(uint64_t)(s.align - 1);
+		next_offset = offset[id] + s.buffer.size();
+	}
+	const uint64_t shstrtab_offset = next_offset;
+	const uint64_t symtab_offset = (shstrtab_offset + shstrtab.size() + 7) & ~7;
+	const uint64_t strtab_offset = symtab_offset + (num_symbols + 1) * sizeof(elf_symbol);
+	const uint64_t symtab_shndx_offset = (strtab_offset + strtab_size + 3) & ~3;
+	std::vector<uint64_t> rela_offset(sections.size());
+	next_offset = (symtab_shndx_offset + extended * (num_symbols + 1) * 4 + 7) & ~7;
+	for (uint32_t id : relocated) {
+		rela_offset[id] = next_offset;
+		next_offset += sections[id].relocs.size() * sizeof(elf_relocation);
+	}
+	f.allocate(next_offset);
+
 	f.write((const char *)&ehdr, sizeof(ehdr));
 
 	// section headers
 	elf_section_header shdr;
 	// null section
 	memset(&shdr, 0, sizeof(shdr));
+	if (ehdr.shnum == 0)
+		shdr.size = shnum;
+	if (ehdr.shstrndx == SHN_XINDEX)
+		shdr.link = shstrtab_index;
 	f.write((const char *)&shdr, sizeof(shdr));
 
-	// text section
-	shdr.name = 1;
-	shdr.type = 1; // progbits
-	shdr.flags = 0x2 | 0x4; // alloc, execinstr
-	shdr.addr = 0;
-	shdr.offset = ehdr.shoff + ehdr.shentsize * ehdr.shnum;
-	shdr.size = text_buffer.size();
-	shdr.link = 0;
-	shdr.info = 0;
-	shdr.addralign = 16;
-	shdr.entsize = 0;
-	f.write((const char *)&shdr, sizeof(shdr));
-
-	size_t next_offset = (shdr.offset + shdr.size + 15) & ~15;
-
-	// data section
-	if (data_size) {
-		shdr.name = 7;
-		shdr.type = 1; // progbits
-		shdr.flags = 0x2 | 0x1; // alloc, write
+	for (uint32_t id : written) {
+		const section_info &s = sections[id];
+		shdr.name = name_offset[id];
+		shdr.type = s.kind == BSS ? 8 : 1; // nobits or progbits
+		shdr.flags = s.flags;
 		shdr.addr = 0;
-		shdr.offset = next_offset;
-		shdr.size = data_size;
+		shdr.offset = offset[id];
+		shdr.size = s.kind == BSS ? s.bss_size : s.buffer.size();
 		shdr.link = 0;
 		shdr.info = 0;
-		shdr.addralign = 4;
-		shdr.entsize = 0;
-		f.write((const char *)&shdr, sizeof(shdr));
-
-		next_offset = (shdr.offset + shdr.size + 3) & ~3;
-	}
-
-	if (rodata_size) {
-		shdr.name = 13;
-		shdr.type = 1; // progbits
-		shdr.flags = 0x2; // alloc
-		shdr.addr = 0;
-		shdr.offset = next_offset;
-		shdr.size = rodata_size;
-		shdr.link = 0;
-		shdr.info = 0;
-		shdr.addralign = 4;
-		shdr.entsize = 0;
-		f.write((const char *)&shdr, sizeof(shdr));
-
-		next_offset += shdr.size;
-	}
-
-	// bss section
-	if (bss_size) {
-		shdr.name = 21;
-		shdr.type = 8; // nobits
-		shdr.flags = 0x2 | 0x1; // alloc, write
-		shdr.addr = 0;
-		shdr.offset = 0;
-		shdr.size = bss_size;
-		shdr.link = 0;
-		shdr.info = 0;
-		shdr.addralign = 1;
+		shdr.addralign = s.align;
 		shdr.entsize = 0;
 		f.write((const char *)&shdr, sizeof(shdr));
 	}
 
 	// shstrtab section
-	shdr.name = 26;
+	shdr.name = shstrtab_name;
 	shdr.type = 3; // strtab
 	shdr.flags = 0;
 	shdr.addr = 0;
-	shdr.offset = next_offset;
-	shdr.size = 63;
+	shdr.offset = shstrtab_offset;
+	shdr.size = shstrtab.size();
 	shdr.link = 0;
 	shdr.info = 0;
 	shdr.addralign = 1;
@@ -124,24 +151,24 @@ void generate_elf(std::ofstream &f, uint64_t bss_size) {
 	f.write((const char *)&shdr, sizeof(shdr));
 
 	// symbol table
-	shdr.name = 36;
+	shdr.name = symtab_name;
 	shdr.type = 2; // symtab
 	shdr.flags = 0;
 	shdr.addr = 0;
-	shdr.offset = shdr.offset + shdr.size;
-	shdr.size = (labels.size() + extern_labels.size() + 1) * sizeof(elf_symbol);
-	shdr.link = ehdr.shnum - 1 - !!relocations.size(); // strtab
-	shdr.info = shdr.size / sizeof(elf_symbol) - global.size() - extern_labels.size(); // index of last local symbol + 1
+	shdr.offset = symtab_offset;
+	shdr.size = (num_symbols + 1) * sizeof(elf_symbol);
+	shdr.link = strtab_index;
+	shdr.info = num_locals + 1; // index of last local symbol + 1
 	shdr.addralign = 8;
 	shdr.entsize = sizeof(elf_symbol);
 	f.write((const char *)&shdr, sizeof(shdr));
 
 	// strtab section
-	shdr.name = 44;
+	shdr.name = strtab_name;
 	shdr.type = 3; // strtab
 	shdr.flags = 0;
 	shdr.addr = 0;
-	shdr.offset = shdr.offset + shdr.size;
+	shdr.offset = strtab_offset;
 	shdr.size = strtab_size;
 	shdr.link = 0;
 	shdr.info = 0;
@@ -149,120 +176,112 @@ void generate_elf(std::ofstream &f, uint64_t bss_size) {
 	shdr.entsize = 0;
 	f.write((const char *)&shdr, sizeof(shdr));
 
-	// relocation table
-	if (relocations.size()) {
-		shdr.name = 52;
+	// section indices of the symbols
+	if (extended) {
+		shdr.name = symtab_shndx_name;
+		shdr.type = 18; // symtab_shndx
+		shdr.flags = 0;
+		shdr.addr = 0;
+		shdr.offset = symtab_shndx_offset;
+		shdr.size = (num_symbols + 1) * 4;
+		shdr.link = symtab_index;
+		shdr.info = 0;
+		shdr.addralign = 4;
+		shdr.entsize = 4;
+		f.write((const char *)&shdr, sizeof(shdr));
+	}
+
+	// relocation tables
+	for (uint32_t id : relocated) {
+		shdr.name = rela_name_offset[id];
 		shdr.type = 4; // rela
 		shdr.flags = 0;
 		shdr.addr = 0;
-		shdr.offset = shdr.offset + shdr.size;
-		shdr.size = relocations.size() * sizeof(elf_relocation);
-		shdr.link = ehdr.shnum - 3; // symtab
-		shdr.info = 1; // text section
+		shdr.offset = rela_offset[id];
+		shdr.size = sections[id].relocs.size() * sizeof(elf_relocation);
+		shdr.link = symtab_index;
+		shdr.info = shndx[id]; // section the relocations apply to
 		shdr.addralign = 8;
 		shdr.entsize = sizeof(elf_relocation);
 		f.write((const char *)&shdr, sizeof(shdr));
 	}
 
-	// write text
-	f.write((const char *)text_buffer.data(), text_buffer.size());
-
-	// seek to multiple of 16
-	f.seekp((f.tellp() + (std::streamoff)15) & ~15);
-
-	// write data
-	f.write((const char *)data_buffer.data(), data_size);
-
-	// seek to multiple of 4
-	f.seekp((f.tellp() + (std::streamoff)3) & ~3);
-
-	// write rodata
-	f.write((const char *)rodata_buffer.data(), rodata_size);
+	// write the sections
+	for (uint32_t id : written) {
+		if (sections[id].kind == BSS)
+			continue;
+		f.skip_to(offset[id]);
+		f.write(sections[id].buffer.data(), sections[id].buffer.size());
+	}
 
 	// write shstrtab
-	f.write("\0.text\0.data\0.rodata\0.bss\0.shstrtab\0.symtab\0.strtab\0.rela.text", 63);
+	f.write(shstrtab.data(), shstrtab.size());
 
-	std::vector<std::string> ordered_labels;
+	// index of each symbol in the symbol table: locals, externs, then globals, after the null symbol
+	std::vector<uint32_t> sym_index(symbols.size());
+	std::vector<uint32_t> ordered_labels(num_symbols);
+	uint32_t next_local = 1, next_extern = 1 + num_locals, next_global = 1 + num_locals + num_externs;
+	for (uint32_t id = 0; id < symbols.size(); id++) {
+		const symbol &s = symbols[id];
+		if (s.section == UNDEF && !s.external)
+			continue;
+		uint32_t &next = s.section == UNDEF ? next_extern : s.global ? next_global : next_local;
+		sym_index[id] = next;
+		ordered_labels[next++ - 1] = id;
+	}
 
-	uint64_t i = 1;
-	elf_symbol sym;
+	// the symbol and string tables are built together and written at once
+	std::vector<elf_symbol> symtab(num_symbols + 1);
+	std::vector<uint32_t> symtab_shndx(extended ? num_symbols + 1 : 0);
+	std::string strtab;
+	strtab.reserve(strtab_size);
 	// null symbol
-	memset(&sym, 0, sizeof(sym));
-	f.write((const char *)&sym, sizeof(sym));
-	sym.info = 0;
-	// write symtab
-	for (const auto &l : labels) {
-		if (global.count(l.first))
-			continue;
-		sym.name = i;
-		i += l.first.size() + 1;
+	memset(symtab.data(), 0, sizeof(elf_symbol));
+	strtab += '\0';
+	for (size_t i = 0; i < num_symbols; i++) {
+		const symbol &s = symbols[ordered_labels[i]];
+		elf_symbol &sym = symtab[i + 1];
+		sym.name = strtab.size();
+		strtab.append(s.name.c_str(), s.name.size() + 1);
+		sym.info = s.section != UNDEF && !s.global ? 0 : 0x10; // local or global
 		sym.other = 0;
-		if (l.second.first == TEXT)
-			sym.shndx = 1; // text
-		else if (l.second.first == DATA)
-			sym.shndx = 2; // data
-		else if (l.second.first == RODATA)
-			sym.shndx = 2 + !!data_size;
-		else
-			sym.shndx = 2 + !!data_size + !!rodata_size; // bss
-		sym.value = l.second.second;
+		const uint32_t index = s.section == UNDEF ? 0 : shndx[s.section_id];
+		sym.shndx = index < SHN_LORESERVE ? index : SHN_XINDEX;
+		if (index >= SHN_LORESERVE)
+			symtab_shndx[i + 1] = index;
+		sym.value = s.section == UNDEF ? 0 : s.offset;
 		sym.size = 0;
-		f.write((const char *)&sym, sizeof(sym));
-		ordered_labels.push_back(l.first);
 	}
-	sym.info = 0x10;
-	sym.shndx = 0;
-	for (const auto &s : extern_labels) {
-		sym.name = i;
-		i += s.size() + 1;
-		f.write((const char *)&sym, sizeof(sym));
-		ordered_labels.push_back(s);
+	f.skip_to(symtab_offset);
+	f.write((const char *)symtab.data(), symtab.size() * sizeof(elf_symbol));
+	f.write(strtab.data(), strtab.size());
+	if (extended) {
+		f.skip_to(symtab_shndx_offset);
+		f.write((const char *)symtab_shndx.data(), symtab_shndx.size() * 4);
 	}
-	for (const auto &l : labels) {
-		if (!global.count(l.first))
-			continue;
-		sym.name = i;
-		i += l.first.size() + 1;
-		sym.other = 0;
-		if (l.second.first == TEXT)
-			sym.shndx = 1; // text
-		else if (l.second.first == DATA)
-			sym.shndx = 2; // data
-		else if (l.second.first == RODATA)
-			sym.shndx = 2 + !!data_size;
-		else
-			sym.shndx = 2 + !!data_size + !!rodata_size; // bss
-		sym.value = l.second.second;
-		sym.size = 0;
-		f.write((const char *)&sym, sizeof(sym));
-		ordered_labels.push_back(l.first);
-	}
-
-	// write strtab
-	f.seekp(f.tellp() + (std::streamoff)1);
-	for (auto &l : ordered_labels)
-		if (l.size())
-			f.write(l.c_str(), l.size() + 1);
 
-	elf_relocation reloc;
-	// write rela.text
-	for (auto &r : relocations) {
-		reloc.offset = r.offset;
-		uint64_t index = std::find(ordered_labels.begin(), ordered_labels.end(), r.symbol) - ordered_labels.begin();
-		reloc.info = (index + 1) << 32;
-		if (r.type == ABS) {
-			if (r.size == 64)
-				reloc.info |= 1;
-			else if (r.size == 32)
-				reloc.info |= 11;
-		} else if (r.type == REL)
-			reloc.info |= 2;
-		else
-			reloc.info |= 4;
-		reloc.addend = r.addend;
-		f.write((const char *)&reloc, sizeof(reloc));
+	// write the relocation tables
+	std::vector<elf_relocation> rela;
+	for (uint32_t id : relocated) {
+		const std::vector<reloc_entry> &relocs = sections[id].relocs;
+		rela.resize(relocs.size());
+		for (size_t i = 0; i < relocs.size(); i++) {
+			const reloc_entry &r = relocs[i];
+			elf_relocation &reloc = rela[i];
+			reloc.offset = r.offset;
+			reloc.info = (uint64_t)sym_index[r.symbol] << 32;
+			if (r.type == ABS) {
+				if (r.size == 64)
+					reloc.info |= 1;
+				else if (r.size == 32)
+					reloc.info |= 11;
+			} else if (r.type == REL)
+				reloc.info |= 2;
+			else
+				reloc.info |= 4;
+			reloc.addend = r.addend;
+		}
+		f.skip_to(rela_offset[id]);
+		f.write((const char *)rela.data(), rela.size() * sizeof(elf_relocation));
 	}
-
-	// close file
-	f.close();
 }
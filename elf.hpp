@@ -4,13 +4,14 @@
 
 #include "defines.hpp"
 
-extern std::vector<std::string> extern_labels;
-extern std::unordered_set<std::string> global;
-extern std::vector<struct reloc_entry> relocations;
-extern std::unordered_map<std::string, std::pair<sect, size_t>> labels;
-extern std::string text_buffer;
-extern std::string data_buffer;
-extern std::string rodata_buffer;
+extern std::deque<symbol> symbols;
+extern std::vector<section_info> sections;
+
+std::vector<uint32_t> written_sections();
+
+// section indices from SHN_LORESERVE on do not fit the 16-bit fields, SHN_XINDEX points to where the real one is
+constexpr uint32_t SHN_LORESERVE = 0xff00;
+constexpr uint16_t SHN_XINDEX = 0xffff;
 
 struct elf_header {
 	uint8_t ident[16];
@@ -45,6 +46,6 @@ struct elf_relocation {
 	int64_t addend;
 };
 
-void generate_elf(std::ofstream &, uint64_t);
+void generate_elf(object_image &);
 
 #endif
@@ -0,0 +1,256 @@
+#include "evex.hpp"
+
+void parse_decorators(std::vector<std::string> &args, evex_decorators &d, const size_t linenum) {
+	static constexpr std::string_view modes[] = {"{rn-sae}", "{rd-sae}", "{ru-sae}", "{rz-sae}", "{sae}"};
+	for (size_t i = 0; i < args.size(); i++) {
+		const size_t pos = args[i].find('{');
+		if (pos == std::string::npos)
+			continue;
+		if (pos == 0) {
+			// after the registers, before the immediate if there is one
+			const auto it = std::find(std::begin(modes), std::end(modes), args[i]);
+			if (it == std::end(modes) || i == 0 || d.rounding != -1)
+				cerr(linenum, "arrondi invalide « " + args[i] + " »");
+			d.rounding = it - std::begin(modes);
+			args.erase(args.begin() + i--);
+			continue;
+		}
+		std::string_view rest = std::string_view(args[i]).substr(pos);
+		while (!rest.empty()) {
+			const size_t end = rest.find('}');
+			if (rest[0] != '{' || end == std::string::npos)
+				cerr(linenum, "décorateur invalide « " + std::string(rest) + " »");
+			const std::string_view deco = rest.substr(1, end - 1);
+			rest.remove_prefix(end + 1);
+			if (!rest.empty() && rest[0] == ' ')
+				rest.remove_prefix(1);
+			const reg_info k = find_reg(deco);
+			uint64_t n = 0;
+			if (i == 0 && k.type == MASK && k.num != 0) {
+				d.mask = k.num;
+			} else if (i == 0 && deco == "z") {
+				d.zero = true;
+			} else if (deco.starts_with("1to") && parse_number(deco.substr(3), n) == std::errc() && std::has_single_bit(n) && n >= 2 && n <= 16 && args[i].find('[') != std::string::npos) {
+				d.broadcast = n;
+			} else {
+				cerr(linenum, "décorateur invalide « {" + std::string(deco) + "} »");
+			}
+		}
+		args[i].erase(pos);
+		if (!args[i].empty() && args[i].back() == ' ')
+			args[i].pop_back();
+	}
+	if (d.zero && !d.mask)
+		cerr(linenum, "{z} sans masque");
+}
+
+// zmm registers, registers 16 to 31, opmasks and decorators only exist with an EVEX prefix
+bool needs_evex(const std::vector<operand> &ops, const evex_decorators &d) {
+	if (d.mask || d.broadcast || d.rounding != -1)
+		return true;
+	for (const operand &op : ops) {
+		if (op.type == REG && (op.reg.type == ZMM || op.reg.type == MASK || op.reg.num >= 16))
+			return true;
+		if (op.type == MEM && (op.size == 512 || op.mem.vsib == 512 || op.mem.vsib_index >= 16))
+			return true;
+	}
+	return false;
+}
+
+// the 8-bit displacement is scaled by the size of the memory access (disp8*N)
+static short disp_scale(const instr_record &p, const evex_decorators &d) {
+	const short element = p.w ? 8 : 4;
+	switch (p.tuple) {
+	case 'f':
+		return d.broadcast ? element : 16 << p.l;
+	case 'm':
+		return 16 << p.l;
+	case 's':
+		return element;
+	case 'x':
+		return 16;
+	case 'y':
+		return 32;
+	}
+	return 1;
+}
+
+static void compress_disp(mem_output &data, const short n) {
+	uint8_t mod = data.rm >> 6;
+	// no base register or rip relative, the displacement is always 32 bits
+	if (data.reloc.second != NONE || (mod != 1 && mod != 2))
+		return;
+	if (data.offset % n == 0 && (int8_t)(data.offset / n) == data.offset / n) {
+		data.offset /= n;
+		data.offsize = 8;
+		mod = 1;
+	} else {
+		data.offsize = 32;
+		mod = 2;
+	}
+	data.rm = (data.rm & 0x3f) | mod << 6;
+}
+
+static bool matches(const instr_record &record, const std::vector<operand> &ops, const std::vector<std::pair<enum op_type, short>> &types, const evex_decorators &d) {
+	if (record.num_operands != ops.size())
+		return false;
+	bool has_mem = false;
+	for (size_t j = 0; j < ops.size(); j++) {
+		const operand_pattern &op = record.operands[j];
+		if (op.kind == 'R') {
+			if (types[j].first != REG || types[j].second != op.size || (op.letter == 'K') != (ops[j].reg.type == MASK))
+				return false;
+		} else if (op.kind == 'M') {
+			if (types[j].first == REG) {
+				// only vector registers can stand for a memory operand
+				if (types[j].second != op.size || op.size < 128 || ops[j].reg.type == MASK)
+					return false;
+			} else if (types[j].first == MEM) {
+				if (ops[j].mem.vsib)
+					return false;
+				has_mem = true;
+				const short element = record.w ? 64 : 32;
+				if (d.broadcast && (record.tuple != 'f' || d.broadcast * element != op.size || (types[j].second != -1 && types[j].second != element)))
+					return false;
+				if (!d.broadcast && types[j].second != -1 && types[j].second != op.size)
+					return false;
+			} else {
+				return false;
+			}
+		} else if (op.kind == 'V') {
+			if (types[j].first != MEM || ops[j].mem.vsib != op.size || d.broadcast)
+				return false;
+			has_mem = true;
+		} else if (op.kind == 'I') {
+			if (types[j].first != IMM || types[j].second > op.size)
+				return false;
+		}
+	}
+	if (d.rounding != -1) {
+		// only between registers, and the rounding mode takes the place of the vector length
+		if (has_mem || !record.rounding || (d.rounding < 4 && record.rounding != 'r') || (record.tuple != 's' && record.l != 2))
+			return false;
+	}
+	return true;
+}
+
+void handle_evex(const std::vector<operand> &ops, const evex_decorators &d, const size_t linenum, const bool prefix, const std::span<const instr_record> records) {
+	error = "";
+	if (prefix)
+		cerr(linenum, "impossible d'utiliser un préfixe avec une instruction EVEX");
+	std::vector<std::pair<enum op_type, short>> types;
+	for (const operand &op : ops) {
+		if (op.type == REG) {
+			types.emplace_back(REG, op.size);
+		} else if (op.type == MEM) {
+			types.emplace_back(MEM, op.size);
+		} else if (op.type == IMM) {
+			const auto &tmp = op.imm;
+			if (tmp.second == -1) {
+				cerr(linenum, error);
+			} else if (tmp.second <= -2) {
+				uses_symbol = true;
+				types.emplace_back(IMM, 32);
+			} else {
+				types.emplace_back(IMM, tmp.second);
+			}
+		}
+	}
+	const instr_record *match = nullptr;
+	for (const instr_record &record : records) {
+		if (!matches(record, ops, types, d))
+			continue;
+		if (match && match->l != record.l)
+			cerr(linenum, "taille d'opération non spécifiée");
+		if (!match)
+			match = &record;
+	}
+	if (!match)
+		cerr(linenum, "combination d'opcode et des opérandes invalide");
+	const instr_record &p = *match;
+	if (d.zero && ops[0].type != REG)
+		cerr(linenum, "impossible d'utiliser {z} avec une destination en mémoire");
+	if (d.zero && ops[0].reg.type == MASK)
+		cerr(linenum, "impossible d'utiliser {z} avec un masque comme destination");
+
+	// the r/m operand is the memory operand, or else the last register, the other registers go in reg and vvvv
+	auto last = [&](char kind) {
+		size_t i = ops.size();
+		for (size_t j = 0; j < ops.size(); j++) {
+			if (p.operands[j].kind == kind)
+				i = j;
+		}
+		return i;
+	};
+	size_t rm_i = std::min(last('M'), last('V'));
+	if (rm_i == ops.size())
+		rm_i = last('R');
+	std::array<short, 2> regs{};
+	size_t num_regs = 0;
+	for (size_t j = 0; j < ops.size(); j++) {
+		if (j != rm_i && p.operands[j].kind == 'R')
+			regs[num_regs++] = ops[j].reg.num;
+	}
+	short reg = 0;
+	short vvvv = 0;
+	if (p.digit != -1) {
+		reg = p.digit;
+		vvvv = regs[0];
+	} else {
+		reg = regs[0];
+		vvvv = regs[1];
+	}
+
+	instr_bytes tmp;
+	mem_output data;
+	// X and B extend the r/m register to 32 registers, or the index and base registers
+	uint8_t xb;
+	if (ops[rm_i].type == REG) {
+		const short num = ops[rm_i].reg.num;
+		data.rm = 0xc0 | (num & 7);
+		xb = (num >> 3 & 2) | (num >> 3 & 1);
+	} else {
+		data = ops[rm_i].mem;
+		xb = data.rex & 0b11;
+		if (p.operands[rm_i].kind == 'V') {
+			// gathers and scatters need a mask, the index extends to 32 registers with V'
+			if (!d.mask || d.zero)
+				cerr(linenum, "un masque sans {z} est nécessaire avec un index vectoriel");
+			if (rm_i != 0 && regs[0] == data.vsib_index)
+				cerr(linenum, "la destination et l'index doivent être différents");
+			vvvv = data.vsib_index & 16;
+		}
+		compress_disp(data, disp_scale(p, d));
+	}
+	if (data.prefix)
+		tmp += data.prefix;
+	// 62, RXBR'00mm, Wvvvv1pp, zL'LbV'aaa with R, X, B, R', vvvv and V' inverted
+	// with rounding control L'L holds the rounding mode, and it is 0 with {sae}
+	const uint8_t ll = d.rounding == -1 ? p.l : d.rounding & 3;
+	tmp += 0x62;
+	tmp += ((reg >> 3 & 1) << 7 | xb << 5 | (reg >> 4 & 1) << 4 | p.mmmmm) ^ 0xf0;
+	tmp += (p.w << 7 | (vvvv & 15) << 3 | 0b100 | p.pp) ^ 0x78;
+	tmp += (d.zero << 7 | ll << 5 | (d.broadcast || d.rounding != -1) << 4 | (vvvv >> 4 & 1) << 3 | d.mask) ^ 0x08;
+	tmp += p.opcode[0];
+	tmp += (uint8_t)data.rm | (reg & 7) << 3;
+	if (data.sib != 0x7fff)
+		tmp += data.sib;
+
+	if (data.reloc.second != NONE) {
+		tmp.relocate({text_buffer.size() + tmp.size, data.offset, data.reloc.second, data.reloc.first, 32});
+		data.offset = 0;
+	}
+
+	for (int i = 0; i < data.offsize; i += 8)
+		tmp += (data.offset >> i) & 0xff;
+
+	for (size_t j = 0; j < ops.size(); j++) {
+		if (p.operands[j].kind == 'I') {
+			for (int i = 0; i < p.operands[j].size; i += 8)
+				tmp += (ops[j].imm.first >> i) & 0xff;
+		}
+	}
+	if (tmp.size > instr_bytes::max_size)
+		cerr(linenum, "instruction trop longue");
+	emit_instr(tmp, linenum);
+}
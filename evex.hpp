@@ -0,0 +1,31 @@
+#pragma once
+#ifndef EVEX_HPP
+#define EVEX_HPP
+
+#include "defines.hpp"
+#include "utility.hpp"
+#include "table.hpp"
+
+extern void cerr(const int i, const std::string &s);
+
+extern std::string text_buffer;
+extern std::string error;
+extern bool uses_symbol;
+
+// {k1}{z} after the destination, {1to16} after a memory operand, {rn-sae} as an operand of its own
+struct evex_decorators {
+	// opmask register, 0 for none
+	uint8_t mask = 0;
+	bool zero = false;
+	// elements of the broadcast, 0 for none
+	short broadcast = 0;
+	// rn, rd, ru, rz, or 4 for {sae}, -1 for none
+	short rounding = -1;
+};
+
+void emit_instr(const instr_bytes &, const size_t);
+void parse_decorators(std::vector<std::string> &, evex_decorators &, const size_t);
+bool needs_evex(const std::vector<operand> &, const evex_decorators &);
+void handle_evex(const std::vector<operand> &, const evex_decorators &, const size_t, const bool, const std::span<const instr_record>);
+
+#endif
@@ -1,38 +1,85 @@
 #include "main.hpp"
 
-// input file
-std::ifstream input;
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#ifdef WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 // input file name
 const char *input_name;
-// output file
-std::ofstream output;
+// read the input from stdin as it arrives instead of mapping a file
+bool stream_input = false;
+// contents of the input file, lines point into it
+char *source = nullptr;
+size_t source_size = 0;
+// output file, -1 until it is opened
+int output_fd = -1;
 // output file name
 char *output_name;
-// lines of input file
-std::vector<std::string> lines;
-// labels in data section (name, offset)
-std::unordered_map<std::string, uint64_t> data_labels;
-std::unordered_map<std::string, uint64_t> rodata_labels;
-std::unordered_map<std::string, uint64_t> bss_labels;
-std::vector<std::string> text_labels;
-std::vector<std::string> extern_labels;
-std::unordered_map<std::string, size_t> text_labels_map;
-std::unordered_map<std::string, size_t> extern_labels_map;
-std::vector<size_t> text_labels_instr;
-// symbols (positions)
+// write the object to stdout
+bool stream_output = false;
+// write the object through a shared mapping of the output file (--mmap)
+bool map_output = false;
+// leave the output file untouched when it already holds the same bytes (--keep-unchanged)
+bool keep_unchanged = false;
+bool output_unchanged = false;
+// a piece of the input cut at a line boundary, it is split into lines, lexed
+// and split into operands independently of the other chunks
+struct chunk {
+	char *begin, *end;
+	// lines of the chunk (views into source)
+	std::vector<std::string_view> lines;
+	// operands of all lines, those of line i are args[arg_index[i]] to args[arg_index[i + 1]]
+	std::vector<std::string_view> args;
+	std::vector<uint32_t> arg_index;
+	// first line of the chunk with an unterminated string
+	size_t error = -1;
+};
+std::vector<chunk> chunks;
+// number of threads used to preprocess the input
+unsigned jobs = 1;
+// number of lines read so far
+size_t line_count = 0;
+// every symbol seen in the file, in order of appearance, a deque so names do not move
+std::deque<symbol> symbols;
+// index of each symbol in symbols, the keys point to the names
+std::unordered_map<std::string_view, uint32_t> symbol_ids;
 std::vector<reloc_entry> relocations;
-std::unordered_map<std::string, std::pair<sect, size_t>> labels;
-// symbol table (name, offset)
-std::unordered_map<std::string, uint64_t> reloc_table;
-// output buffer
+// contents of the code section being filled
 std::string text_buffer;
-std::string data_buffer;
-std::string rodata_buffer;
-uint64_t bss_size = 0;
+// sections of the object, the usual ones first
+std::vector<section_info> sections = {
+	{".text", TEXT, SHF_ALLOC | SHF_EXECINSTR, 16, {}, 0, {}, {}},
+	{".data", DATA, SHF_ALLOC | SHF_WRITE, 4, {}, 0, {}, {}},
+	{".rodata", RODATA, SHF_ALLOC, 4, {}, 0, {}, {}},
+	{".bss", BSS, SHF_ALLOC | SHF_WRITE, 1, {}, 0, {}, {}},
+};
+// index of each section in sections
+std::unordered_map<std::string, uint32_t> section_ids = {{".text", 0}, {".data", 1}, {".rodata", 2}, {".bss", 3}};
+// put each global label of a code section in a section of its own (-ffunction-sections)
+bool function_sections = false;
 // last label that was not a dot
 std::string prev_label;
-// global symbols
-std::unordered_set<std::string> global;
+// alignment of global labels and the most bytes skipped to reach it (-falign-functions)
+std::pair<int, int> function_align = {16, 15};
+// set by a falign directive for the next global label only
+std::pair<int, int> next_function_align = {0, 0};
+// longest nop used for padding, depends on the target processor (-mtune)
+size_t max_nop = 11;
+// only use the nops without a prefix, the 2 and 6 byte ones are replaced with shorter ones (-mtune=atom)
+bool prefix_free_nops = false;
+// print the time spent in each phase
+bool show_time = false;
+// print statistics about the assembly
+bool show_stats = false;
 // output format
 #ifdef WINDOWS
 format output_format = COFF;
@@ -44,21 +91,160 @@ format output_format = ELF;
 
 void print_help(const char *name) {
 	std::cout << "Usage : " << name << " [options] fichier\n";
+	std::cout << "« - » lit le fichier depuis l'entrée standard ou écrit la sortie sur la sortie standard\n";
 	std::cout << "Options :\n";
 	std::cout << "-h, --help\t\tAfficher cette aide\n";
 	std::cout << "-o, --output\t\tFichier de sortie\n";
 	std::cout << "-f, --format\t\tFormat de sortie (elf, coff, macho)\n";
+	std::cout << "-j N\t\t\tPrétraiter le fichier sur N fils d'exécution\n";
+	std::cout << "--mmap\t\t\tÉcrire le fichier de sortie par une projection en mémoire\n";
+	std::cout << "--keep-unchanged\tNe pas réécrire le fichier de sortie s'il est identique\n";
+	std::cout << "-falign-functions=N[:M]\tAligner les étiquettes globales sur N octets en sautant au plus M - 1 octets\n";
+	std::cout << "-ffunction-sections\tPlacer chaque étiquette globale du code dans sa propre section\n";
+	std::cout << "-falign-loops=N[:M]\tAligner les cibles des sauts arrière sur N octets en sautant au plus M - 1 octets\n";
+	std::cout << "-mtune=CPU\t\tChoisir les nops de remplissage pour CPU (generic, zen, atom)\n";
+	std::cout << "-Os\t\t\tChoisir les formes équivalentes les plus courtes\n";
+	std::cout << "-mbranches-within-32B-boundaries\n\t\t\tÉloigner les sauts et les paires fusionnées des limites de 32 octets\n";
+	std::cout << "-t, --time\t\tAfficher le temps passé dans chaque phase\n";
+	std::cout << "-s, --stats\t\tAfficher des statistiques sur l'assemblage\n";
 }
 
 void cerr(const int i, const std::string &msg) {
 	std::cerr << input_name << ":" << i << ": erreur : " << msg << std::endl;
-	if (output.is_open()) {
-		output.close();
+	if (output_fd != -1) {
+		close(output_fd);
 		remove(output_name);
 	}
 	exit(1);
 }
 
+// open the output file, for reading too since it may be mapped or compared,
+// it is only truncated once it is known to change with --keep-unchanged
+bool open_output(const char *name) {
+	const int trunc = keep_unchanged ? 0 : O_TRUNC;
+#ifdef WINDOWS
+	output_fd = open(name, O_RDWR | O_CREAT | trunc | O_BINARY, 0666);
+#else
+	output_fd = open(name, O_RDWR | O_CREAT | trunc, 0666);
+#endif
+	return output_fd != -1;
+}
+
+// the output file already holds exactly the bytes of the image
+bool same_output(const object_image &image) {
+	char chunk[1 << 16];
+	size_t done = 0;
+	while (true) {
+		const auto n = read(output_fd, chunk, sizeof(chunk));
+		if (n < 0)
+			return false;
+		if (n == 0)
+			return done == image.size;
+		if (done + n > image.size || memcmp(chunk, image.data + done, n) != 0)
+			return false;
+		done += n;
+	}
+}
+
+void object_image::allocate(size_t n) {
+	size = n;
+	pos = 0;
+#ifndef WINDOWS
+	// the file gets its final size at once and the sections are copied straight into the page cache,
+	// the buffer is used when the output can not be mapped
+	if (map_output && !keep_unchanged && output_fd != -1 && ftruncate(output_fd, n) == 0) {
+		void *ptr = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, output_fd, 0);
+		if (ptr != MAP_FAILED) {
+			data = (char *)ptr;
+			mapped = true;
+			return;
+		}
+	}
+#endif
+	buffer.assign(n, '\0');
+	data = buffer.data();
+}
+
+// write the whole object with as few calls as the system allows, or release its mapping
+bool flush_output(object_image &image) {
+#ifndef WINDOWS
+	if (image.mapped)
+		return munmap(image.data, image.size) == 0;
+#endif
+	if (keep_unchanged && !stream_output) {
+		if (same_output(image)) {
+			output_unchanged = true;
+			return true;
+		}
+		if (lseek(output_fd, 0, SEEK_SET) != 0)
+			return false;
+	}
+	const int fd = stream_output ? 1 : output_fd;
+	size_t done = 0;
+	while (done < image.size) {
+		const auto n = write(fd, image.data + done, image.size - done);
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	// the previous contents may have been longer
+	if (keep_unchanged && !stream_output)
+#ifdef WINDOWS
+		return _chsize(output_fd, image.size) == 0;
+#else
+		return ftruncate(output_fd, image.size) == 0;
+#endif
+	return true;
+}
+
+// map the input file into memory, the mapping is private and writable so lex_line() can rewrite lines in place
+bool load_input(const char *name) {
+#ifdef WINDOWS
+	std::ifstream f(name, std::ios::binary);
+	if (!f.is_open())
+		return false;
+	f.seekg(0, std::ios::end);
+	source_size = f.tellg();
+	f.seekg(0, std::ios::beg);
+	source = new char[source_size + 1];
+	f.read(source, source_size);
+#else
+	int fd = open(name, O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+	source_size = st.st_size;
+	if (source_size) {
+		void *ptr = mmap(nullptr, source_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (ptr == MAP_FAILED)
+			return false;
+		source = (char *)ptr;
+	} else {
+		close(fd);
+	}
+#endif
+	return true;
+}
+
+// alignment of the next global label and the most bytes that may be skipped for it
+int parse_falign(std::string_view s, std::pair<int, int> &align) {
+	const size_t colon = s.find(':');
+	uint64_t n = 0, max = 0;
+	if (parse_number(s.substr(0, colon), n) != std::errc() || n == 0 || n > 1 << 16 || !std::has_single_bit(n))
+		return 1;
+	if (colon == std::string_view::npos)
+		max = n;
+	else if (parse_number(s.substr(colon + 1), max) != std::errc() || max == 0)
+		return 1;
+	align = {(int)n, (int)max - 1};
+	return 0;
+}
+
 int parse_args(int argc, char *argv[]) {
 	if (argc < 2) {
 		print_help(argv[0]);
@@ -67,8 +253,10 @@ int parse_args(int argc, char *argv[]) {
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] != '-' || argv[i][1] == '\0') {
 			input_name = argv[i];
-			input.open(input_name);
-			if (!input.is_open()) {
+			if (strcmp(input_name, "-") == 0) {
+				input_name = "<stdin>";
+				stream_input = true;
+			} else if (!load_input(input_name)) {
 				std::cerr << "Erreur : Impossible d'ouvrir le fichier d'entrée " << input_name << std::endl;
 				return 1;
 			}
@@ -79,11 +267,11 @@ int parse_args(int argc, char *argv[]) {
 				exit(0);
 			} else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) {
 				if (i + 1 < argc) {
-					output.open(argv[i + 1], std::ios::binary);
+					// opened once every option is known
 					output_name = argv[i + 1];
-					if (!output.is_open()) {
-						std::cerr << "Erreur : Impossible d'ouvrir le fichier de sortie " << argv[i + 1] << std::endl;
-						return 1;
+					if (strcmp(output_name, "-") == 0) {
+						output_name = nullptr;
+						stream_output = true;
 					}
 					i++;
 				} else {
@@ -106,6 +294,54 @@ int parse_args(int argc, char *argv[]) {
 					std::cerr << "Erreur : Aucun format de sortie spécifié" << std::endl;
 					return 1;
 				}
+			} else if (strcmp(argv[i], "--mmap") == 0) {
+				map_output = true;
+			} else if (strcmp(argv[i], "--keep-unchanged") == 0) {
+				keep_unchanged = true;
+			} else if (strncmp(argv[i], "-j", 2) == 0) {
+				// -jN or -j N
+				const char *n = argv[i][2] ? argv[i] + 2 : i + 1 < argc ? argv[++i] : "";
+				auto res = std::from_chars(n, n + strlen(n), jobs);
+				if (res.ec != std::errc() || *res.ptr || jobs == 0) {
+					std::cerr << "Erreur : Nombre de fils d'exécution invalide « " << n << " »" << std::endl;
+					return 1;
+				}
+			} else if (strncmp(argv[i], "-falign-functions=", 18) == 0) {
+				if (parse_falign(argv[i] + 18, function_align)) {
+					std::cerr << "Erreur : Alignement invalide « " << argv[i] + 18 << " »" << std::endl;
+					return 1;
+				}
+			} else if (strcmp(argv[i], "-ffunction-sections") == 0) {
+				function_sections = true;
+			} else if (strncmp(argv[i], "-falign-loops=", 14) == 0) {
+				if (parse_falign(argv[i] + 14, loop_align)) {
+					std::cerr << "Erreur : Alignement invalide « " << argv[i] + 14 << " »" << std::endl;
+					return 1;
+				}
+			} else if (strncmp(argv[i], "-mtune=", 7) == 0) {
+				// generic: up to 11 bytes like most assemblers, zen decodes 15 byte nops at full speed,
+				// atom is slowed down by prefixes
+				prefix_free_nops = false;
+				if (strcmp(argv[i] + 7, "generic") == 0) {
+					max_nop = 11;
+				} else if (strcmp(argv[i] + 7, "zen") == 0) {
+					max_nop = 15;
+				} else if (strcmp(argv[i] + 7, "atom") == 0) {
+					max_nop = 8;
+					prefix_free_nops = true;
+				} else {
+					std::cerr << "Erreur : Processeur inconnu « " << argv[i] + 7 << " »" << std::endl;
+					return 1;
+				}
+			} else if (strcmp(argv[i], "-Os") == 0) {
+				optimize_size = true;
+			} else if (strcmp(argv[i], "-mbranches-within-32B-boundaries") == 0) {
+				align_branches = true;
+				min_text_align = 32;
+			} else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--time") == 0) {
+				show_time = true;
+			} else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stats") == 0) {
+				show_stats = true;
 			} else {
 				fprintf(stderr, "Erreur : Option inconnue %s\n", argv[i]);
 				return 1;
@@ -115,374 +351,562 @@ int parse_args(int argc, char *argv[]) {
 	return 0;
 }
 
-const std::regex lead_trail(R"(^\s*(.*?)\s*$)"), between(R"(\s*([,+\-*\/:\\"])\s*)");
+// bytes the scanner has to look at: comments, quotes and whitespace
+static inline bool is_special(char c) {
+	return c == ';' || c == '"' || c == '\'' || (unsigned char)c <= ' ';
+}
 
-void preprocess() {
-	for (size_t i = 0; i < lines.size(); i++) {
-		std::string &line = lines[i];
-		// remove comments
-		bool in_string = false;
-		for (size_t i = 0; i < line.size(); i++) {
-			if (line[i] == '"' && (i == 0 || line[i - 1] != '\\'))
-				in_string = !in_string;
-			if (line[i] == ';' && !in_string) {
-				line = line.substr(0, i);
-				break;
-			}
+// whitespace next to these characters is removed
+static inline bool is_sep_before(char c) {
+	return c == ',' || c == '+' || c == '-' || c == '*' || c == '/' || c == ':' || c == '\\' || c == '[';
+}
+
+static inline bool is_sep_after(char c) {
+	return c == ',' || c == '+' || c == '-' || c == '*' || c == '/' || c == ':' || c == '\\' || c == ']';
+}
+
+// find the first special byte in [p, end), 16 bytes at a time when possible
+static inline const char *find_special(const char *p, const char *end) {
+#ifdef __SSE2__
+	const __m128i semi = _mm_set1_epi8(';'), dquote = _mm_set1_epi8('"'), squote = _mm_set1_epi8('\''), space = _mm_set1_epi8(' ');
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, semi), _mm_cmpeq_epi8(v, dquote));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, squote));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, space), v));
+		uint32_t mask = _mm_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && !is_special(*p))
+		p++;
+	return p;
+}
+
+// strip the comment, remove leading and trailing whitespace and whitespace around separators,
+// collapse the remaining whitespace to a single space, all in one pass over the line
+// the line is rewritten in place, returns false if a string is not terminated
+bool lex_line(std::string_view &line) {
+	char *const dst = const_cast<char *>(line.data());
+	char *w = dst;
+	const char *p = line.data();
+	const char *const end = p + line.size();
+	// the space after the mnemonic is kept before a sign, so "push -1" stays two words
+	bool spaced = false;
+	while (true) {
+		const char *q = find_special(p, end);
+		memmove(w, p, q - p);
+		w += q - p;
+		p = q;
+		if (p == end || *p == ';')
+			break;
+		if (*p == '"' || *p == '\'') {
+			// copy the string as is
+			const char quote = *p;
+			q = p + 1;
+			while (q < end && *q != quote)
+				q += *q == '\\' ? 2 : 1;
+			if (q >= end)
+				return false;
+			q++;
+			memmove(w, p, q - p);
+			w += q - p;
+			p = q;
+			continue;
 		}
-		if (in_string)
-			cerr(i + 1, "chaîne de caractères non terminée");
-		// remove leading and trailing whitespace
-		line = std::regex_replace(line, lead_trail, "$1");
-		// remove whitespace between tokens
-		size_t l = 0;
-		size_t r = line.find('"', l);
-		while (r != 0 && r != std::string::npos) {
-			if (line[r - 1] != '\\')
-				break;
-			r = line.find('"', r + 1);
+		while (p < end && (unsigned char)*p <= ' ')
+			p++;
+		if (w == dst || p == end || *p == ';' || is_sep_before(w[-1]))
+			continue;
+		if (is_sep_after(*p) && (spaced || (*p != '-' && *p != '+')))
+			continue;
+		*w++ = ' ';
+		spaced = true;
+	}
+	line = std::string_view(dst, w - dst);
+	return true;
+}
+
+// splits "instr arg1,arg2,..." into its arguments, commas inside strings and characters are kept
+void split_args(std::string_view line, std::vector<std::string_view> &args) {
+	size_t pos = line.find(' ');
+	if (pos == std::string::npos)
+		return;
+	size_t start = ++pos;
+	char quote = 0;
+	for (; pos < line.size(); pos++) {
+		const char c = line[pos];
+		if (quote) {
+			if (c == '\\')
+				pos++;
+			else if (c == quote)
+				quote = 0;
+		} else if (c == '"' || c == '\'') {
+			quote = c;
+		} else if (c == ',') {
+			args.push_back(line.substr(start, pos - start));
+			start = pos + 1;
 		}
-		if (r == std::string::npos) {
-			line = std::regex_replace(line, between, "$1");
+	}
+	args.push_back(line.substr(start));
+}
+
+// everything that does not depend on the previous lines: splitting, lexing and operands
+void preprocess_chunk(chunk &c) {
+	c.lines.reserve((c.end - c.begin) / 16);
+	c.arg_index.reserve((c.end - c.begin) / 16 + 1);
+	char *p = c.begin;
+	while (p < c.end) {
+		char *nl = (char *)memchr(p, '\n', c.end - p);
+		if (nl == nullptr)
+			nl = c.end;
+		std::string_view line(p, nl - p);
+		if (!lex_line(line) && c.error == (size_t)-1)
+			c.error = c.lines.size();
+		c.lines.push_back(line);
+		c.arg_index.push_back(c.args.size());
+		split_args(line, c.args);
+		p = nl + 1;
+	}
+	c.arg_index.push_back(c.args.size());
+}
+
+// cut the input into one chunk per thread and preprocess them in parallel
+void preprocess() {
+	size_t n = jobs;
+	// not worth it for small files
+	if (source_size < (1 << 16))
+		n = 1;
+	chunks.resize(n);
+	char *const end = source + source_size;
+	char *p = source;
+	for (size_t i = 0; i < n; i++) {
+		chunks[i].begin = p;
+		if (i == n - 1) {
+			p = end;
 		} else {
-			while (r != std::string::npos) {
-				if (l == 0)
-					line = std::regex_replace(line.substr(l, r - l), between, "$1") + line.substr(r);
-				else
-					line = line.substr(0, l) + std::regex_replace(line.substr(l, r - l - 1), between, "$1") + line.substr(r);
-				l = r + 1;
-				r = line.find('"', l);
-				while (r != 0 && r != std::string::npos) {
-					if (line[r - 1] != '\\')
-						break;
-					r = line.find('"', r + 1);
-				}
-				l = r + 1;
-				r = line.find('"', l);
-				while (r != 0 && r != std::string::npos) {
-					if (line[r - 1] != '\\')
-						break;
-					r = line.find('"', r + 1);
-				}
-			}
-			line = line.substr(0, l) + std::regex_replace(line.substr(l, line.size() - l), between, "$1");
+			p = std::max(p, source + source_size / n * (i + 1));
+			char *nl = (char *)memchr(p, '\n', end - p);
+			p = nl ? nl + 1 : end;
 		}
+		chunks[i].end = p;
+	}
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < n; i++)
+		threads.emplace_back(preprocess_chunk, std::ref(chunks[i]));
+	preprocess_chunk(chunks[0]);
+	for (auto &t : threads)
+		t.join();
+	size_t first = 0;
+	for (const auto &c : chunks) {
+		if (c.error != (size_t)-1)
+			cerr(first + c.error + 1, "chaîne de caractères non terminée");
+		first += c.lines.size();
 	}
+	line_count = first;
 }
 
 void parse_d(std::string &instr, std::vector<std::string> &args, size_t line, std::string &output_buffer) {
 	for (size_t i = 0; i < args.size(); i++) {
-		if (args[i][0] == '"') {
-			for (size_t j = 1; j < args[i].size() - 1; j++) {
-				if (args[i][j] == '\\') {
-					switch (args[i][j + 1]) {
-					case '0':
-						output_buffer += '\0';
-						break;
-					case 'n':
-						output_buffer += '\n';
-						break;
-					case 'r':
-						output_buffer += '\r';
-						break;
-					case 't':
-						output_buffer += '\t';
-						break;
-					case '\\':
-						output_buffer += '\\';
-						break;
-					case '"':
-						output_buffer += '"';
-						break;
-					case '\'':
-						output_buffer += '\'';
-						break;
-					case 'x':
-						output_buffer += std::stoul(args[i].substr(j + 2, 2), nullptr, 16);
-						j += 2;
-						break;
-					}
-					j++;
-				} else
-					output_buffer += args[i][j];
+		const std::string &arg = args[i];
+		if (arg[0] == '"') {
+			for (size_t j = 1; j < arg.size() - 1; j++) {
+				// the bytes up to the next escape are copied at once
+				const size_t esc = std::min(arg.find('\\', j), arg.size() - 1);
+				output_buffer.append(arg, j, esc - j);
+				j = esc;
+				if (j == arg.size() - 1)
+					break;
+				switch (arg[j + 1]) {
+				case '0':
+					output_buffer += '\0';
+					break;
+				case 'n':
+					output_buffer += '\n';
+					break;
+				case 'r':
+					output_buffer += '\r';
+					break;
+				case 't':
+					output_buffer += '\t';
+					break;
+				case '\\':
+					output_buffer += '\\';
+					break;
+				case '"':
+					output_buffer += '"';
+					break;
+				case '\'':
+					output_buffer += '\'';
+					break;
+				case 'x': {
+					unsigned char c = 0;
+					std::from_chars(arg.data() + j + 2, arg.data() + std::min(j + 4, arg.size()), c, 16);
+					output_buffer += c;
+					j += 2;
+					break;
+				}
+				}
+				j++;
 			}
 			continue;
 		}
-		if (args[i][0] == '\'') {
-			output_buffer.push_back(args[i][1]);
-		} else if (instr == "db") {
-			output_buffer += std::stoul(args[i], nullptr, 0);
-		} else if (instr == "dw") {
-			uint16_t val = std::stoul(args[i], nullptr, 0);
-			output_buffer += val & 0xff;
-			output_buffer += (val >> 8) & 0xff;
-		} else if (instr == "dd") {
-			uint32_t val = std::stoul(args[i], nullptr, 0);
-			output_buffer += val & 0xff;
-			output_buffer += (val >> 8) & 0xff;
-			output_buffer += (val >> 16) & 0xff;
-			output_buffer += (val >> 24) & 0xff;
-		} else if (instr == "dq") {
-			uint64_t val = std::stoull(args[i], nullptr, 0);
-			output_buffer += val & 0xff;
-			output_buffer += (val >> 8) & 0xff;
-			output_buffer += (val >> 16) & 0xff;
-			output_buffer += (val >> 24) & 0xff;
-			output_buffer += (val >> 32) & 0xff;
-			output_buffer += (val >> 40) & 0xff;
-			output_buffer += (val >> 48) & 0xff;
-			output_buffer += (val >> 56) & 0xff;
-		} else {
+		if (arg[0] == '\'') {
+			output_buffer.push_back(arg[1]);
+			continue;
+		}
+		const size_t width = instr == "db" ? 1 : instr == "dw" ? 2 : instr == "dd" ? 4 : instr == "dq" ? 8 : 0;
+		if (width == 0)
 			cerr(line + 1, "directive inconnue « " + instr + " »");
+		uint64_t val = 0;
+		if (parse_number(arg, val) != std::errc())
+			cerr(line + 1, "valeur invalide « " + arg + " »");
+		char bytes[8];
+		for (size_t j = 0; j < width; j++)
+			bytes[j] = (val >> (j * 8)) & 0xff;
+		output_buffer.append(bytes, width);
+	}
+}
+
+// argument of an align directive
+int parse_align(std::string_view s, size_t line) {
+	uint64_t align = 0;
+	if (parse_number(s, align) != std::errc() || align == 0 || align > 1 << 16)
+		cerr(line + 1, "alignement invalide « " + std::string(s) + " »");
+	return align;
+}
+
+// recommended multi-byte nops, the longer ones repeat the 0x66 prefix in front of a cs prefix
+void fill_nops(std::string &output_buffer, size_t n) {
+	using namespace std::string_view_literals;
+	static constexpr std::string_view nops[] = {
+		""sv,
+		"\x90"sv,
+		"\x66\x90"sv,
+		"\x0f\x1f\x00"sv,
+		"\x0f\x1f\x40\x00"sv,
+		"\x0f\x1f\x44\x00\x00"sv,
+		"\x66\x0f\x1f\x44\x00\x00"sv,
+		"\x0f\x1f\x80\x00\x00\x00\x00"sv,
+		"\x0f\x1f\x84\x00\x00\x00\x00\x00"sv,
+		"\x66\x0f\x1f\x84\x00\x00\x00\x00\x00"sv,
+	};
+	while (n) {
+		size_t len = std::min(n, max_nop);
+		if (prefix_free_nops && nops[len][0] == '\x66')
+			len--;
+		if (len < std::size(nops)) {
+			output_buffer += nops[len];
+		} else {
+			output_buffer.append(len - 9, '\x66');
+			output_buffer += '\x2e';
+			output_buffer += nops[8];
 		}
+		n -= len;
 	}
 }
 
 void pad(int align, std::string &output_buffer) {
-	int pad = output_buffer.size() % align;
-	if (!pad)
-		return;
-	pad = align - pad;
-	while (pad >= 11) {
-		output_buffer += "\x66\x66\x66\x0f\x1f\x84\x90\x90\x90\x90\x90";
-		pad -= 11;
+	fill_nops(output_buffer, (align - output_buffer.size() % align) % align);
+}
+
+// kind and index of the section of the line being processed
+sect curr_sect = UNDEF;
+uint32_t curr_index = 0;
+// section chosen by the last section directive, -ffunction-sections names its sections after it
+uint32_t base_index = 0;
+
+// sections that reach the object file: the named ones and those that hold something,
+// with -ffunction-sections a code section left empty only gave its name to those of its functions
+std::vector<uint32_t> written_sections() {
+	std::vector<bool> labelled(sections.size());
+	for (const symbol &s : symbols)
+		if (s.section != UNDEF)
+			labelled[s.section_id] = true;
+	std::vector<uint32_t> written;
+	for (uint32_t i = 0; i < sections.size(); i++) {
+		const section_info &s = sections[i];
+		const bool named = i >= builtin_sections && !(function_sections && s.kind == TEXT);
+		if (named || s.buffer.size() || s.bss_size || s.relocs.size() || labelled[i])
+			written.push_back(i);
 	}
-	if (pad == 1)
-		output_buffer += '\x90';
-	else if (pad == 2)
-		output_buffer += "\x66\x90";
-	else if (pad == 3)
-		output_buffer += "\x0f\x1f\xc0";
-	else if (pad == 4)
-		output_buffer += "\x0f\x1f\x40\x90";
-	else if (pad == 5)
-		output_buffer += "\x0f\x1f\x44\x90\x90";
-	else if (pad == 6)
-		output_buffer += "\x66\x0f\x1f\x44\x90\x90";
-	else if (pad == 7)
-		output_buffer += "\x0f\x1f\x80\x90\x90\x90\x90";
-	else if (pad == 8)
-		output_buffer += "\x0f\x1f\x84\x90\x90\x90\x90\x90";
-	else if (pad == 9)
-		output_buffer += "\x66\x0f\x1f\x84\x90\x90\x90\x90\x90";
-	else if (pad == 10)
-		output_buffer += "\x66\x66\x0f\x1f\x84\x90\x90\x90\x90\x90";
-}
-
-void parse_labels() {
-	sect curr_sect = UNDEF;
-	size_t instr_cnt = 0;
-	for (size_t i = 0; i < lines.size(); i++) {
-		std::string line = lines[i];
-		while (line.size() == 0 && ++i < lines.size())
-			line = lines[i];
-		if (i == lines.size())
-			break;
-		if (line.starts_with("section ")) {
-			if (line == "section .text") {
-				curr_sect = TEXT;
-			} else if (line == "section .data") {
-				curr_sect = DATA;
-			} else if (line == "section .rodata") {
-				curr_sect = RODATA;
-			} else if (line == "section .bss") {
-				curr_sect = BSS;
-			} else {
-				cerr(i + 1, "section inconnue « " + line.substr(8) + " »");
-			}
-			prev_label = "";
-		} else if (line.find(':') != std::string::npos && line.find_first_of(" \t\"'") > line.find(':')) {
-			if (line.size() == 1)
+	return written;
+}
+
+void enter_section(const uint32_t index) {
+	curr_sect = sections[index].kind;
+	curr_index = index;
+	if (curr_sect == TEXT)
+		select_text(index);
+}
+
+// index of the section called name, created with the given attributes the first time
+uint32_t find_section(const std::string &name, const sect kind, const uint64_t flags, const uint32_t align) {
+	const auto [it, inserted] = section_ids.try_emplace(name, sections.size());
+	if (inserted)
+		sections.push_back({name, kind, flags, kind == TEXT ? std::max<uint32_t>(align, min_text_align) : align, {}, 0, {}, {}});
+	return it->second;
+}
+
+// section name [flags] [align=N], flags are letters among a (allocated), w (writable) and x (executable),
+// nobits makes a section without contents; the usual names give the defaults
+void parse_section(std::string_view line, const size_t i) {
+	std::vector<std::string_view> words;
+	for (size_t start = 0; start < line.size();) {
+		const size_t end = std::min(line.find(' ', start), line.size());
+		if (end > start)
+			words.push_back(line.substr(start, end - start));
+		start = end + 1;
+	}
+	if (words.empty())
+		cerr(i + 1, "nom de section manquant");
+	const std::string name(words[0]);
+	auto prefixed = [&](std::string_view prefix) { return name == prefix || name.starts_with(std::string(prefix) + '.'); };
+	uint64_t flags = prefixed(".text") ? SHF_ALLOC | SHF_EXECINSTR : prefixed(".data") || prefixed(".bss") ? SHF_ALLOC | SHF_WRITE : prefixed(".rodata") ? SHF_ALLOC : 0;
+	bool nobits = prefixed(".bss");
+	bool given = false;
+	uint64_t align = 0;
+	for (size_t w = 1; w < words.size(); w++) {
+		const std::string_view word = words[w];
+		if (word.starts_with("align=")) {
+			if (parse_number(word.substr(6), align) != std::errc() || !std::has_single_bit(align) || align > 1 << 16)
+				cerr(i + 1, "alignement invalide « " + std::string(word.substr(6)) + " »");
+		} else if (word == "nobits") {
+			nobits = true;
+			given = true;
+		} else if (word.find_first_not_of("awx") == std::string_view::npos) {
+			flags = 0;
+			for (const char c : word)
+				flags |= c == 'a' ? SHF_ALLOC : c == 'w' ? SHF_WRITE : SHF_EXECINSTR;
+			given = true;
+		} else {
+			cerr(i + 1, "attribut de section inconnu « " + std::string(word) + " »");
+		}
+	}
+	const sect kind = nobits ? BSS : flags & SHF_EXECINSTR ? TEXT : flags & SHF_WRITE ? DATA : RODATA;
+	const uint32_t index = find_section(name, kind, flags, kind == TEXT ? 16 : kind == BSS ? 1 : 4);
+	section_info &info = sections[index];
+	if (given && (info.kind != kind || info.flags != flags))
+		cerr(i + 1, "attributs différents pour la section « " + name + " »");
+	info.align = std::max<uint32_t>(info.align, align);
+	base_index = index;
+	enter_section(index);
+	if (curr_sect == TEXT)
+		text_align = std::max<uint64_t>(text_align, align);
+}
+
+// lines are processed in a single pass, sections are filled in order and forward references
+// to text labels are patched once the label is defined
+// i is the index of the line (its number minus one)
+void process_line(std::string_view line, const size_t i, std::span<const std::string_view> arg_views) {
+	if (line.size() == 0)
+		return;
+	if (line.starts_with("section ")) {
+		parse_section(line.substr(8), i);
+		prev_label = "";
+	} else if (curr_sect == TEXT) {
+		// parse instruction
+		std::string instr(line.substr(0, line.find(' ')));
+		if (instr.ends_with(':')) {
+			if (instr.size() == 1)
 				cerr(i + 1, "étiquette vide");
-			if (curr_sect == TEXT) {
-				std::string label = line.substr(0, line.size() - 1);
-				if (line[0] == '.') {
-					if (prev_label == "")
-						cerr(i + 1, "étiquette sans étiquette parente");
-					label = prev_label + label;
-				} else {
-					prev_label = label;
-				}
-				line = label + ":";
-				text_labels_map[label] = text_labels.size();
-				text_labels.push_back(label);
-				text_labels_instr.push_back(instr_cnt);
-			} else if (curr_sect == UNDEF) {
-				cerr(i + 1, "étiquette hors d'une section");
-			} else if (curr_sect == BSS) {
-				if (line.starts_with("global ")) {
-					std::string label = line.substr(7);
-					if (label[0] == '.')
-						cerr(i + 1, "étiquette locale dans une directive global");
-					global.insert(label);
-					continue;
-				}
-				std::string label = line.substr(0, line.find(':'));
-				std::string instr = line.substr(line.find(':') + 1, line.find(' ') - line.find(':') - 1);
-				size_t size = std::strtoull(line.substr(line.find(' ') + 1).c_str(), nullptr, 10);
-				bss_labels[label] = bss_size;
-				if (instr == "resb") {
-					bss_size += size;
-				} else if (instr == "resw") {
-					bss_size += size * 2;
-				} else if (instr == "resd") {
-					bss_size += size * 4;
-				} else if (instr == "resq") {
-					bss_size += size * 8;
-				} else {
-					cerr(i + 1, "directive inconnue « " + instr + " »");
+			instr = instr.substr(0, instr.size() - 1);
+			if (instr[0] != '.') {
+				prev_label = instr.substr(0, instr.find('.'));
+				if (function_sections) {
+					const section_info &base = sections[base_index];
+					enter_section(find_section(base.name + '.' + prev_label, TEXT, base.flags, base.align));
 				}
-			} else if (curr_sect == DATA || curr_sect == RODATA) {
-				std::string &output_buffer = curr_sect == DATA ? data_buffer : rodata_buffer;
-				if (line.starts_with("global ")) {
-					std::string label = line.substr(7);
-					if (label[0] == '.')
-						cerr(i + 1, "étiquette locale dans une directive global");
-					global.insert(label);
-					continue;
-				}
-				std::string label = line.substr(0, line.find(':'));
-				std::string instr = line.substr(line.find(':') + 1, line.find(' ') - line.find(':') - 1);
-				std::vector<std::string> args;
-				size_t pos = line.find(' ');
-				while (pos != std::string::npos) {
-					size_t next = line.find(',', pos + 1);
-					while (next != std::string::npos) {
-						std::string tmp = line.substr(0, next);
-						if (std::count(tmp.begin(), tmp.end(), '\"') % 2 == 0)
-							break;
-						next = line.find(',', next + 1);
-					}
-					if (next == std::string::npos) {
-						next = line.size();
-						args.push_back(line.substr(pos + 1, next - pos - 1));
-						break;
-					}
-					args.push_back(line.substr(pos + 1, next - pos - 1));
-					pos = next;
-				}
-				size_t tmp = output_buffer.size();
-				parse_d(instr, args, i, output_buffer);
-				(curr_sect == DATA ? data_labels : rodata_labels)[label] = tmp;
-			}
-		} else if (curr_sect == TEXT && !line.starts_with("global ") && !line.starts_with("extern ") && !line.starts_with("align")) {
-			if (line[0] != 'd' || line[2] != ' ') {
-				instr_cnt++;
-				continue;
+				const auto align = next_function_align.first ? next_function_align : function_align;
+				align_text(align.first, align.second);
+				next_function_align = {0, 0};
+			} else {
+				if (prev_label == "")
+					cerr(i + 1, "étiquette sans étiquette parente");
+				instr = prev_label + instr;
 			}
-			std::vector<std::string> args;
-			size_t pos = line.find(' ');
-			while (pos != std::string::npos) {
-				size_t next = line.find(',', pos + 1);
-				if (next == std::string::npos) {
-					next = line.size();
-					args.push_back(line.substr(pos + 1, next - pos - 1));
-					break;
-				}
-				args.push_back(line.substr(pos + 1, next - pos - 1));
-				pos = next;
+			const uint32_t id = intern(instr);
+			if (symbols[id].section != TEXT || symbols[id].section_id != curr_index)
+				sections[curr_index].labels.push_back(id);
+			symbols[id].section = TEXT;
+			symbols[id].section_id = curr_index;
+			symbols[id].offset = text_buffer.size();
+			return;
+		} else {
+			for (size_t i = 0; i < instr.size(); i++)
+				instr[i] = tolower(instr[i]);
+		}
+		if (instr == "global") {
+			std::string label(line.substr(7));
+			if (label[0] == '.') {
+				std::cerr << "avertissement : " << input_name << ':' << i + 1 << ": étiquette locale dans une directive global" << std::endl;
+				label = prev_label + label;
 			}
-			size_t delta = 0;
-			if (line[1] == 'b') {
-				for (const auto &arg : args) {
-					if (arg[0] == '"')
-						delta += arg.size() - 2;
-					else
-						delta++;
-				}
-			} else if (line[1] == 'w') {
-				delta += args.size() * 2;
-			} else if (line[1] == 'd') {
-				delta += args.size() * 4;
+			symbols[intern(label)].global = true;
+			return;
+		} else if (instr == "extern") {
+			std::string label(line.substr(7));
+			if (label[0] == '.')
+				cerr(i + 1, "étiquette locale dans une directive extern");
+			symbols[intern(label)].external = true;
+			return;
+		}
+		if (instr[0] == 'd' && instr.size() == 2) {
+			std::vector<std::string> args(arg_views.begin(), arg_views.end());
+			parse_d(instr, args, i, text_buffer);
+		} else if (instr == "align") {
+			const int align = parse_align(arg_views[0], i);
+			align_text(align, align - 1);
+		} else if (instr == "falign") {
+			// alignment of the next global label, overrides -falign-functions
+			if (arg_views.size() != 1 || parse_falign(arg_views[0], next_function_align))
+				cerr(i + 1, "alignement invalide « " + std::string(line.substr(instr.size())) + " »");
+		} else {
+			handle_line(instr + std::string(line.substr(instr.size())), instr, arg_views, i + 1);
+		}
+	} else if (line.starts_with("global ")) {
+		std::string label(line.substr(7));
+		if (label[0] == '.')
+			cerr(i + 1, "étiquette locale dans une directive global");
+		symbols[intern(label)].global = true;
+	} else if (line.starts_with(".align ")) {
+		if (curr_sect == DATA || curr_sect == RODATA) {
+			const int align = parse_align(line.substr(7), i);
+			pad(align, sections[curr_index].buffer);
+			sections[curr_index].align = std::max<uint32_t>(sections[curr_index].align, align);
+		}
+	} else if (line.find(':') != std::string::npos && line.find_first_of(" \t\"'") > line.find(':')) {
+		if (line.size() == 1)
+			cerr(i + 1, "étiquette vide");
+		if (curr_sect == UNDEF) {
+			cerr(i + 1, "étiquette hors d'une section");
+		} else if (curr_sect == BSS) {
+			std::string label(line.substr(0, line.find(':')));
+			std::string instr(line.substr(line.find(':') + 1, line.find(' ') - line.find(':') - 1));
+			size_t size = 0;
+			std::from_chars(line.data() + line.find(' ') + 1, line.data() + line.size(), size);
+			const uint32_t id = intern(label);
+			uint64_t &bss_size = sections[curr_index].bss_size;
+			symbols[id].section = BSS;
+			symbols[id].section_id = curr_index;
+			symbols[id].offset = bss_size;
+			if (instr == "resb") {
+				bss_size += size;
+			} else if (instr == "resw") {
+				bss_size += size * 2;
+			} else if (instr == "resd") {
+				bss_size += size * 4;
+			} else if (instr == "resq") {
+				bss_size += size * 8;
 			} else {
-				delta += args.size() * 8;
+				cerr(i + 1, "directive inconnue « " + instr + " »");
 			}
-			instr_cnt += delta / 15 + !!(delta % 15);
-		} else if (line.starts_with(".align ")) {
-			int align = std::stoi(line.substr(7));
-			if (curr_sect == TEXT) {
-				instr_cnt += (align + 14) / 15;
-				continue;
-			}
-			pad(align, curr_sect == DATA ? data_buffer : rodata_buffer);
+		} else {
+			std::string &output_buffer = sections[curr_index].buffer;
+			std::string label(line.substr(0, line.find(':')));
+			std::string instr(line.substr(line.find(':') + 1, line.find(' ') - line.find(':') - 1));
+			std::vector<std::string> args(arg_views.begin(), arg_views.end());
+			const uint32_t id = intern(label);
+			symbols[id].section = curr_sect;
+			symbols[id].section_id = curr_index;
+			symbols[id].offset = output_buffer.size();
+			parse_d(instr, args, i, output_buffer);
 		}
 	}
 }
 
+// checks done once the whole file has been read
+void finish_instructions() {
+	// every symbol used before its definition must have been defined by now, the first one is reported
+	const symbol *undefined = nullptr;
+	for (const symbol &s : symbols) {
+		if (s.first_use && s.section == UNDEF && !s.external && (!undefined || s.first_use < undefined->first_use))
+			undefined = &s;
+	}
+	if (undefined)
+		cerr(undefined->first_use, "symbole « " + undefined->name + " » non défini");
+	finish_text();
+}
+
 void process_instructions() {
-	sect curr_sect = UNDEF;
-	size_t instr_cnt = 0;
-	for (size_t i = 0; i < lines.size(); i++) {
-		std::string line = lines[i];
-		while (line.size() == 0 && ++i < lines.size())
-			line = lines[i];
-		if (i == lines.size())
-			break;
-		if (line.starts_with("section ")) {
-			if (line == "section .text") {
-				curr_sect = TEXT;
-			} else if (line == "section .data") {
-				curr_sect = DATA;
-			} else if (line == "section .bss") {
-				curr_sect = BSS;
-			}
-		} else {
-			if (curr_sect == TEXT) {
-				// parse instruction
-				std::string instr = line.substr(0, line.find(' '));
-				if (instr.ends_with(':')) {
-					instr = instr.substr(0, instr.size() - 1);
-					if (instr[0] != '.') {
-						prev_label = instr.substr(0, instr.find('.'));
-						pad(16, text_buffer);
-					} else {
-						instr = prev_label + instr;
-					}
-					reloc_table[instr] = text_buffer.size();
-					continue;
-				} else {
-					for (size_t i = 0; i < instr.size(); i++)
-						instr[i] = tolower(instr[i]);
-				}
-				if (instr == "global") {
-					std::string label = line.substr(7);
-					if (label[0] == '.') {
-						std::cerr << "avertissement : " << input_name << ':' << i + 1 << ": étiquette locale dans une directive global" << std::endl;
-						label = prev_label + label;
-					}
-					global.insert(label);
-					continue;
-				} else if (instr == "extern") {
-					std::string label = line.substr(7);
-					if (label[0] == '.')
-						cerr(i + 1, "étiquette locale dans une directive extern");
-					extern_labels_map[label] = extern_labels.size();
-					extern_labels.push_back(label);
-					continue;
-				}
-				std::vector<std::string> args;
-				size_t pos = line.find(' ');
-				while (pos != std::string::npos) {
-					size_t next = line.find(',', pos + 1);
-					if (next == std::string::npos) {
-						next = line.size();
-						args.push_back(line.substr(pos + 1, next - pos - 1));
-						break;
-					}
-					args.push_back(line.substr(pos + 1, next - pos - 1));
-					pos = next;
-				}
-				if (instr[0] == 'd' && instr.size() == 2) {
-					parse_d(instr, args, i, text_buffer);
-				} else if (instr == "align") {
-					pad(std::stoi(args[0]), text_buffer);
-				} else {
-					handle(instr, args, i + 1, instr_cnt);
-				}
-				instr_cnt++;
-			}
+	// most instructions take a few bytes, so the text section rarely grows past this
+	text_buffer.reserve(line_count * 4);
+	size_t i = 0;
+	for (const auto &c : chunks) {
+		for (size_t j = 0; j < c.lines.size(); j++, i++)
+			process_line(c.lines[j], i, std::span(c.args.data() + c.arg_index[j], c.args.data() + c.arg_index[j + 1]));
+	}
+	finish_instructions();
+}
+
+// read stdin in chunks and assemble every complete line as soon as it arrives,
+// only the incomplete last line of a chunk is kept around
+void process_stream() {
+	constexpr size_t chunk_size = 1 << 16;
+	std::string buffer;
+	std::vector<std::string_view> args;
+	size_t pending = 0;
+	while (true) {
+		buffer.resize(pending + chunk_size);
+		size_t n = fread(buffer.data() + pending, 1, chunk_size, stdin);
+		const bool eof = n == 0;
+		size_t end = pending + n;
+		size_t start = 0;
+		while (start < end) {
+			char *nl = (char *)memchr(buffer.data() + start, '\n', end - start);
+			if (nl == nullptr && !eof)
+				break;
+			size_t len = (nl ? nl - buffer.data() : end) - start;
+			std::string_view line(buffer.data() + start, len);
+			if (!lex_line(line))
+				cerr(line_count + 1, "chaîne de caractères non terminée");
+			args.clear();
+			split_args(line, args);
+			process_line(line, line_count++, args);
+			start += len + 1;
 		}
+		if (eof)
+			break;
+		pending = end - start;
+		memmove(buffer.data(), buffer.data() + start, pending);
 	}
+	if (ferror(stdin))
+		cerr(line_count, "erreur de lecture de l'entrée standard");
+	finish_instructions();
+}
+
+void report_time(const char *phase, std::chrono::steady_clock::time_point &start) {
+	auto end = std::chrono::steady_clock::now();
+	if (show_time) {
+		double secs = std::chrono::duration<double>(end - start).count();
+		std::cerr << phase << " : " << std::fixed << std::setprecision(3) << secs * 1000 << " ms";
+		if (secs > 0)
+			std::cerr << " (" << std::setprecision(0) << line_count / secs << " lignes/s)";
+		std::cerr << std::endl;
+	}
+	start = end;
+}
+
+void report_stats() {
+	if (!show_stats)
+		return;
+	std::cerr << "cache d'encodage : " << cache_hits << " / " << cache_lookups << " instructions";
+	if (cache_lookups)
+		std::cerr << " (" << std::fixed << std::setprecision(1) << cache_hits * 100.0 / cache_lookups << " %)";
+	std::cerr << std::endl;
+	std::cerr << "branchements : " << short_branches << " courts, " << long_branches << " longs" << std::endl;
+	size_t remaining = 0;
+	for (const section_info &s : sections)
+		remaining += s.relocs.size();
+	std::cerr << "réadressages : " << resolved_relocations << " résolus, " << remaining << " restants" << std::endl;
+	if (loop_align.first)
+		std::cerr << "boucles alignées : " << aligned_loops << " (" << loop_padding << " octets de remplissage)" << std::endl;
+	if (align_branches)
+		std::cerr << "limites de 32 octets : " << boundary_prefixes + boundary_nops << " octets insérés (" << boundary_prefixes << " préfixes, " << boundary_nops << " en nops)" << std::endl;
+	if (keep_unchanged && !stream_output)
+		std::cerr << "fichier de sortie : " << (output_unchanged ? "inchangé" : "réécrit") << std::endl;
 }
 
 int main(int argc, char *argv[]) {
@@ -491,11 +915,14 @@ int main(int argc, char *argv[]) {
 
 	// if the file could not be opened it would have been caught earlier
 	// so that means there was no attempt to open a file at all
-	if (!input.is_open()) {
+	if (input_name == nullptr) {
 		std::cerr << "Erreur : aucun fichier d'entrée specifié" << std::endl;
 		return 1;
 	}
-	if (!output.is_open()) {
+	// reading from stdin without an output file writes to stdout
+	if (stream_input && output_name == nullptr)
+		stream_output = true;
+	if (output_name == nullptr && !stream_output) {
 		std::string tmp = std::string(input_name);
 		tmp = tmp.substr(0, tmp.find_last_of('.'));
 		if (output_format == ELF || output_format == MACHO)
@@ -505,44 +932,53 @@ int main(int argc, char *argv[]) {
 		output_name = new char[tmp.size() + 1];
 		memcpy(output_name, tmp.c_str(), tmp.size() + 1);
 		output_name[tmp.size()] = '\0';
-		output.open(output_name, std::ios::binary);
-		if (!output.is_open()) {
-			std::cerr << "Erreur : impossible d'ouvrir le fichier de sortie « " << output_name << " »" << std::endl;
-			return 1;
-		}
-	}
-	// load lines into vector
-	std::string line;
-	while (std::getline(input, line))
-		lines.push_back(line);
-
-	preprocess();
-
-	parse_labels();
-
-	// put all labels into a map
-	for (const auto &l : data_labels) {
-		labels[l.first] = {DATA, l.second};
 	}
-	for (const auto &l : rodata_labels) {
-		labels[l.first] = {RODATA, l.second};
-	}
-	for (const auto &l : bss_labels) {
-		labels[l.first] = {BSS, l.second};
-	}
-	for (const auto &l : text_labels) {
-		labels[l] = {TEXT, 0};
+	if (!stream_output && !open_output(output_name)) {
+		std::cerr << "Erreur : impossible d'ouvrir le fichier de sortie « " << output_name << " »" << std::endl;
+		return 1;
 	}
+	auto start = std::chrono::steady_clock::now();
 
-	process_instructions();
+	if (stream_input) {
+#ifdef WINDOWS
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		process_stream();
+		report_time("assemblage", start);
+	} else {
+		preprocess();
+		report_time("prétraitement", start);
 
-	for (const auto &l : reloc_table)
-		labels[l.first] = {TEXT, l.second};
+		process_instructions();
+		report_time("assemblage", start);
+	}
 
+#ifdef WINDOWS
+	if (stream_output)
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	object_image image;
 	if (output_format == ELF)
-		generate_elf(output, bss_size);
-	else if (output_format == COFF)
-		generate_coff(output, bss_size);
+		generate_elf(image);
+	else if (output_format == COFF && !generate_coff(image)) {
+		if (output_fd != -1) {
+			close(output_fd);
+			remove(output_name);
+		}
+		return 1;
+	}
+	if (!flush_output(image)) {
+		std::cerr << "Erreur : impossible d'écrire le fichier de sortie « " << (stream_output ? "-" : output_name) << " »" << std::endl;
+		if (output_fd != -1) {
+			close(output_fd);
+			remove(output_name);
+		}
+		return 1;
+	}
+	if (output_fd != -1)
+		close(output_fd);
+	report_time("écriture", start);
+	report_stats();
 
 	return 0;
 }
@@ -0,0 +1,259 @@
+#include "table.hpp"
+#include "instr.dat"
+#include "vex.dat"
+#include "evex.dat"
+
+// the lines of the tables are decoded when compiling, and their mnemonics are put in a perfect hash table:
+// buckets of mnemonics are displaced until every mnemonic has a slot of its own (hash and displace)
+
+struct table_entry {
+	// offset of the mnemonic in its table, 0 for an empty slot
+	uint32_t name = 0;
+	uint8_t len = 0;
+	// 0 for instr.dat, 1 for vex.dat, 2 for evex.dat
+	uint8_t table = 0;
+	// lines of the mnemonic in records
+	uint16_t begin = 0;
+	uint16_t end = 0;
+};
+
+constexpr uint32_t hash(std::string_view s, uint32_t seed) {
+	// FNV-1a with a final mix
+	uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+	for (char c : s) {
+		h ^= (unsigned char)c;
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return h;
+}
+
+constexpr const char *table_text(uint8_t t) {
+	return t == 2 ? evex_map : t == 1 ? vex_map : map;
+}
+
+constexpr size_t table_size(uint8_t t) {
+	return t == 2 ? evex_map_size : t == 1 ? vex_map_size : map_size;
+}
+
+// a mnemonic starts every line that follows a blank line
+constexpr size_t count_lines(uint8_t t, bool mnemonics) {
+	const char *text = table_text(t);
+	size_t n = 0;
+	for (size_t i = 2; i < table_size(t); i++)
+		if (text[i] != '\n' && text[i - 1] == '\n' && (!mnemonics || text[i - 2] == '\n'))
+			n++;
+	return n;
+}
+
+constexpr std::string_view mnemonic_at(uint8_t t, size_t i) {
+	const char *text = table_text(t);
+	return std::string_view(text + i, std::find(text + i, text + table_size(t), ' ') - (text + i));
+}
+
+// offsets of the mnemonics of a table
+template <uint8_t t>
+constexpr std::array<uint32_t, count_lines(t, true)> mnemonic_starts() {
+	std::array<uint32_t, count_lines(t, true)> starts{};
+	const char *text = table_text(t);
+	size_t n = 0;
+	for (size_t i = 2; i < table_size(t); i++)
+		if (text[i] != '\n' && text[i - 1] == '\n' && text[i - 2] == '\n')
+			starts[n++] = i;
+	return starts;
+}
+
+constexpr auto vex_starts = mnemonic_starts<1>();
+constexpr auto evex_starts = mnemonic_starts<2>();
+
+// offset of a mnemonic in evex.dat, 0 if it has no EVEX form
+constexpr uint32_t find_evex(std::string_view name) {
+	for (uint32_t i : evex_starts)
+		if (mnemonic_at(2, i) == name)
+			return i;
+	return 0;
+}
+
+constexpr bool has_vex(std::string_view name) {
+	for (uint32_t i : vex_starts)
+		if (mnemonic_at(1, i) == name)
+			return true;
+	return false;
+}
+
+// the EVEX lines of a mnemonic that also has VEX lines follow them, so the mnemonic has one entry
+constexpr size_t count_shared() {
+	size_t n = 0;
+	for (uint32_t i : vex_starts)
+		n += find_evex(mnemonic_at(1, i)) != 0;
+	return n;
+}
+
+constexpr size_t num_records = count_lines(0, false) + count_lines(1, false) + count_lines(2, false);
+constexpr size_t num_mnemonics = count_lines(0, true) + count_lines(1, true) + count_lines(2, true) - count_shared();
+constexpr size_t num_slots = std::bit_ceil(num_mnemonics * 2);
+constexpr size_t num_buckets = num_mnemonics / 2 + 1;
+
+constexpr uint8_t hex_digit(char c) {
+	return c >= 'a' ? c - 'a' + 10 : c - '0';
+}
+
+constexpr uint8_t hex_byte(const char *s) {
+	return hex_digit(s[0]) << 4 | hex_digit(s[1]);
+}
+
+// "andn RD RD MD 0.0.2.0.f2", "add MD IB 83/0", "addpd RX MX p66w0f58", "vaddps RZ RZ MZ 2.0.1.0.fr.58"
+constexpr instr_record decode_line(const char *l, const char *r, uint8_t t) {
+	instr_record rec;
+	rec.vex = t == 1;
+	rec.evex = t == 2;
+	l = std::find(l, r, ' ') + 1;
+	const char *last = r;
+	while (last[-1] != ' ')
+		last--;
+	for (; l < last; l = std::find(l, r, ' ') + 1) {
+		operand_pattern &op = rec.operands[rec.num_operands++];
+		if (l[0] == 'R' || l[0] == 'M' || l[0] == 'I' || l[0] == 'V') {
+			op.kind = l[0];
+			op.letter = l[1];
+		} else if (l[0] == 'L') {
+			op.kind = 'L';
+			op.value = l[1] - '0';
+		} else if ((l[0] >= '0' && l[0] <= '9') || (l[0] >= 'a' && l[0] <= 'f')) {
+			op.kind = 'F';
+			op.letter = l[1];
+			op.value = hex_digit(l[0]);
+		} else {
+			throw "ensemble d'instructions mal configuré";
+		}
+		if (op.letter >= 'A' && op.letter <= 'Z')
+			op.size = _sizes[op.letter - 'A'];
+	}
+	if (t != 0) {
+		rec.l = l[0] - '0';
+		rec.pp = l[2] - '0';
+		rec.mmmmm = l[4] - '0';
+		rec.w = l[6] - '0';
+		l += 8;
+		if (t == 2) {
+			rec.tuple = l[0];
+			if (l[1] != '.')
+				rec.rounding = l[1];
+			l = std::find(l, r, '.') + 1;
+		}
+	} else {
+		if (l[0] == 'p') {
+			rec.prefix = hex_byte(l + 1);
+			l += 3;
+		}
+		if (l[0] == 'w') {
+			rec.rex_w = true;
+			l++;
+		}
+	}
+	for (; l < r && l[0] != '/'; l += 2)
+		rec.opcode[rec.opcode_size++] = hex_byte(l);
+	if (l < r)
+		rec.digit = hex_digit(l[1]);
+	return rec;
+}
+
+constexpr std::string_view entry_name(const table_entry &e) {
+	return std::string_view(table_text(e.table) + e.name, e.len);
+}
+
+struct hash_table {
+	std::array<instr_record, num_records> records;
+	std::array<table_entry, num_slots> slots;
+	std::array<uint16_t, num_buckets> disp;
+};
+
+constexpr hash_table build_table() {
+	hash_table table{};
+	std::array<table_entry, num_mnemonics> entries;
+	size_t n = 0;
+	size_t n_records = 0;
+	// the lines of a mnemonic end at the next blank line
+	auto add_lines = [&](uint8_t t, size_t i) {
+		const char *text = table_text(t);
+		while (text[i] != '\n') {
+			const char *r = std::find(text + i, text + table_size(t), '\n');
+			table.records[n_records++] = decode_line(text + i, r, t);
+			i = r - text + 1;
+		}
+	};
+	for (uint8_t t : {0, 1, 2}) {
+		const char *text = table_text(t);
+		for (size_t i = 2; i < table_size(t); i++) {
+			if (text[i] == '\n' || text[i - 1] != '\n' || text[i - 2] != '\n')
+				continue;
+			const std::string_view name = mnemonic_at(t, i);
+			if (t == 2 && has_vex(name))
+				continue;
+			table_entry &e = entries[n++];
+			e.name = i;
+			e.table = t;
+			e.len = name.size();
+			e.begin = n_records;
+			add_lines(t, i);
+			if (t == 1 && find_evex(name))
+				add_lines(2, find_evex(name));
+			e.end = n_records;
+		}
+	}
+
+	// sort the mnemonics by bucket
+	std::array<size_t, num_buckets + 1> bucket_start{};
+	for (const auto &e : entries)
+		bucket_start[hash(entry_name(e), 0) % num_buckets + 1]++;
+	size_t largest = 0;
+	for (size_t b = 0; b < num_buckets; b++) {
+		largest = std::max(largest, bucket_start[b + 1]);
+		bucket_start[b + 1] += bucket_start[b];
+	}
+	std::array<size_t, num_buckets> fill{};
+	std::array<table_entry, num_mnemonics> sorted;
+	for (const auto &e : entries) {
+		size_t b = hash(entry_name(e), 0) % num_buckets;
+		sorted[bucket_start[b] + fill[b]++] = e;
+	}
+
+	// place the largest buckets first, while the table is still mostly empty
+	std::array<bool, num_slots> used{};
+	for (size_t size = largest; size > 0; size--) {
+		for (size_t b = 0; b < num_buckets; b++) {
+			if (bucket_start[b + 1] - bucket_start[b] != size)
+				continue;
+			for (uint16_t d = 1;; d++) {
+				std::array<size_t, 16> slots{};
+				bool ok = true;
+				for (size_t i = 0; i < size && ok; i++) {
+					slots[i] = hash(entry_name(sorted[bucket_start[b] + i]), d) & (num_slots - 1);
+					ok = !used[slots[i]];
+					for (size_t j = 0; j < i && ok; j++)
+						ok = slots[i] != slots[j];
+				}
+				if (!ok)
+					continue;
+				for (size_t i = 0; i < size; i++) {
+					used[slots[i]] = true;
+					table.slots[slots[i]] = sorted[bucket_start[b] + i];
+				}
+				table.disp[b] = d;
+				break;
+			}
+		}
+	}
+	return table;
+}
+
+constexpr hash_table table = build_table();
+
+std::span<const instr_record> find_instr(std::string_view s) {
+	const table_entry &e = table.slots[hash(s, table.disp[hash(s, 0) % num_buckets]) & (num_slots - 1)];
+	if (e.len != s.size() || entry_name(e) != s)
+		return {};
+	return std::span(table.records.data() + e.begin, e.end - e.begin);
+}
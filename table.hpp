@@ -0,0 +1,46 @@
+#pragma once
+#ifndef TABLE_HPP
+#define TABLE_HPP
+
+#include "defines.hpp"
+
+// operand of a line of the tables
+struct operand_pattern {
+	// R register, M register or memory, I immediate, L number encoded in the opcode, F fixed register,
+	// V memory with a vector index register (VSIB)
+	char kind = 0;
+	// size letter, * for memory of any size
+	char letter = 0;
+	short size = -1;
+	// register number of F, number of L
+	short value = 0;
+};
+
+// line of instr.dat, vex.dat or evex.dat, decoded when compiling
+struct instr_record {
+	std::array<operand_pattern, 4> operands{};
+	uint8_t num_operands = 0;
+	std::array<uint8_t, 4> opcode{};
+	uint8_t opcode_size = 0;
+	// mandatory prefix, 0 if none
+	uint8_t prefix = 0;
+	bool rex_w = false;
+	// reg field of the ModRM byte, -1 if the opcode has no /digit
+	int8_t digit = -1;
+	bool vex = false;
+	uint8_t l = 0;
+	uint8_t pp = 0;
+	uint8_t mmmmm = 0;
+	uint8_t w = 0;
+	bool evex = false;
+	// tuple type of the memory operand, it scales the 8-bit displacement (disp8*N):
+	// f full vector or broadcast element, m full vector, s one element, x 16 bytes, y 32 bytes
+	char tuple = 0;
+	// r for embedded rounding, e for exceptions suppressed only
+	char rounding = 0;
+};
+
+// lines of a mnemonic, empty if it is unknown
+std::span<const instr_record> find_instr(std::string_view);
+
+#endif
@@ -0,0 +1,73 @@
+section .data
+a: dd 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+b: dd 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+counts: dq 3, 0, 1, 0
+two: dd 2
+ten: dd 10
+half: dd 0x40200000
+format: db "%d", 10, 0
+section .text
+global _start
+extern printf
+extern exit
+_start:
+	; sum of 2 * a + 1 over the even lanes
+	lea rbx, [rel a]
+	vmovdqu32 zmm16, [rbx]
+	vpbroadcastd zmm17, [rel two]
+	vpmulld zmm16, zmm16, zmm17
+	vpaddd zmm16, zmm16, [rbx]{1to16}
+	mov eax, 0x5555
+	kmovw k1, eax
+	vpxord zmm0, zmm0, zmm0
+	vmovdqa32 zmm0{k1}, zmm16
+	call sum
+	; lanes greater than 10
+	vpcmpgtd k2, zmm16, [rel ten]{1to16}
+	kmovw eax, k2
+	popcnt esi, eax
+	call print
+	; zero the other lanes
+	vpaddd zmm0{k2}{z}, zmm16, zmm16
+	call sum
+	; b + b[0]
+	vmovdqu32 zmm0, [rbx + 64]
+	vpaddd zmm0, zmm0, [rbx + 64]{1to16}
+	call sum
+	; a shifted by counts from an xmm register and from memory
+	vmovdqu32 zmm16, [rbx]
+	vmovdqu64 xmm18, [rbx + 128]
+	vpslld zmm0, zmm16, xmm18
+	call sum
+	vpsrld zmm0, zmm16, [rbx + 144]
+	call sum
+	; 2.5 rounded down and up
+	vbroadcastss zmm1, [rel half]
+	vcvtps2dq zmm0, zmm1, {rd-sae}
+	vmovd esi, xmm0
+	call print
+	vbroadcastss zmm1, [rel half]
+	vcvtps2dq zmm0, zmm1, {ru-sae}
+	vmovd esi, xmm0
+	call print
+	xor edi, edi
+	call exit wrt ..plt
+
+; prints the sum of the lanes of zmm0
+sum:
+	vextracti64x4 ymm1, zmm0, 1
+	vpaddd ymm0, ymm0, ymm1
+	vextracti32x4 xmm1, ymm0, 1
+	vpaddd xmm0, xmm0, xmm1
+	vpshufd xmm1, xmm0, 0x4e
+	vpaddd xmm0, xmm0, xmm1
+	vpshufd xmm1, xmm0, 0xb1
+	vpaddd xmm0, xmm0, xmm1
+	vmovd esi, xmm0
+print:
+	sub rsp, 8
+	lea rdi, [rel format]
+	xor eax, eax
+	call printf wrt ..plt
+	add rsp, 8
+	ret
@@ -0,0 +1,85 @@
+; flags: -mbranches-within-32B-boundaries
+section .data
+	fmt: db "%ld", 10, 0
+section .text
+global _start
+extern printf
+extern exit
+_start:
+	; collatz steps of 1 to 1000, every loop ends with a fused pair
+	xor r12, r12
+	mov r13, 1
+	.outer:
+	mov rax, r13
+	.inner:
+	cmp rax, 1
+	je .done
+	inc r12
+	test rax, 1
+	jz .even
+	lea rax, [rax+rax*2+1]
+	jmp .inner
+	.even:
+	shr rax, 1
+	jmp .inner
+	.done:
+	inc r13
+	cmp r13, 1000
+	jbe .outer
+	mov rsi, r12
+	call print
+	; 1 when none of the branches below crosses or ends on a 32-byte boundary of the section
+	lea rbx, [rel corpus.s0]
+	lea rbp, [rel corpus.e0]
+	call check
+	lea rbx, [rel corpus.s1]
+	lea rbp, [rel corpus.e1]
+	call check
+	lea rbx, [rel corpus.s2]
+	lea rbp, [rel corpus.e2]
+	call check
+	mov edi, 0
+	call exit wrt ..plt
+check:
+	lea rax, [rel _start]
+	sub rbx, rax
+	sub rbp, rax
+	mov rsi, rbx
+	xor rsi, rbp
+	shr rsi, 5
+	sete sil
+	movzx esi, sil
+print:
+	sub rsp, 8
+	lea rdi, [rel fmt]
+	xor eax, eax
+	call printf wrt ..plt
+	add rsp, 8
+	ret
+; never run, only its layout is checked, every branch would cross a 32-byte boundary without padding
+falign 32
+corpus:
+	mov rcx, 0x1234567812345678
+	mov r8, 0x1234567812345678
+	mov edx, 7
+	add eax, 0x12345678
+	.s0:
+	cmp rcx, rdx
+	jne corpus
+	.e0:
+	mov rcx, 0x1234567812345678
+	mov r8, 0x1234567812345678
+	add eax, 0x12345678
+	nop
+	.s1:
+	jmp exit wrt ..plt
+	.e1:
+	mov rcx, 0x1234567812345678
+	mov r8, 0x1234567812345678
+	xor edx, edx
+	vpor xmm1, xmm2, xmm3
+	.s2:
+	test rax, rax
+	jz corpus
+	.e2:
+	ret
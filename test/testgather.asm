@@ -0,0 +1,55 @@
+section .data
+table: dd 0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150
+index: dd 3, 1, 4, 1, 5, 9, 2, 6, 15, 14, 13, 12, 11, 10, 8, 7
+four: dd 4
+format: db "%d", 10, 0
+section .text
+global _start
+extern printf
+extern exit
+_start:
+	; table[index[i]] for the first 8 indices
+	lea rbx, [rel table]
+	vmovdqu ymm1, [rel index]
+	vpcmpeqd ymm2, ymm2, ymm2
+	vpgatherdd ymm0, [rbx + ymm1*4], ymm2
+	vextracti128 xmm1, ymm0, 1
+	vpaddd xmm0, xmm0, xmm1
+	call sum
+	; the same with qword indices, 4 at a time
+	vpmovzxdq ymm1, [rel index]
+	vpcmpeqd xmm2, xmm2, xmm2
+	vxorps xmm0, xmm0, xmm0
+	vpgatherqd xmm0, [rbx + ymm1*4], xmm2
+	call sum
+	; the first 4 as floats, the bits are summed as integers
+	vmovdqu xmm1, [rel index]
+	vpcmpeqd xmm2, xmm2, xmm2
+	vgatherdps xmm0, [rbx + xmm1*4], xmm2
+	call sum
+	; only the lanes whose index is greater than 4, the others keep their zero
+	vmovdqu ymm1, [rel index]
+	vpbroadcastd ymm3, [rel four]
+	vpcmpgtd ymm2, ymm1, ymm3
+	vxorps ymm0, ymm0, ymm0
+	vgatherdps ymm0, [rbx + ymm1*4], ymm2
+	vextracti128 xmm1, ymm0, 1
+	vpaddd xmm0, xmm0, xmm1
+	call sum
+	xor edi, edi
+	call exit wrt ..plt
+
+; prints the sum of the lanes of xmm0
+sum:
+	vpshufd xmm1, xmm0, 0x4e
+	vpaddd xmm0, xmm0, xmm1
+	vpshufd xmm1, xmm0, 0xb1
+	vpaddd xmm0, xmm0, xmm1
+	vmovd esi, xmm0
+print:
+	sub rsp, 8
+	lea rdi, [rel format]
+	xor eax, eax
+	call printf wrt ..plt
+	add rsp, 8
+	ret
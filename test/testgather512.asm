@@ -0,0 +1,46 @@
+section .data
+table: dd 0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150
+index: dd 3, 1, 4, 1, 5, 9, 2, 6, 15, 14, 13, 12, 11, 10, 8, 7
+out: dd 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+format: db "%d", 10, 0
+section .text
+global _start
+extern printf
+extern exit
+_start:
+	; all 16 indices, then scatter them back to where they came from
+	lea rbx, [rel table]
+	vmovdqu32 zmm1, [rel index]
+	kxnorw k1, k1, k1
+	vpgatherdd zmm0{k1}, [rbx + zmm1*4]
+	kxnorw k2, k2, k2
+	lea rcx, [rel out]
+	vpscatterdd [rcx + zmm1*4]{k2}, zmm0
+	vmovdqu32 zmm0, [rcx]
+	vpsubd zmm0, zmm0, [rbx]
+	vptestmd k3, zmm0, zmm0
+	kmovw esi, k3
+	call print
+	vmovdqu32 zmm0, [rel out]
+	vextracti64x4 ymm1, zmm0, 1
+	vpaddd ymm0, ymm0, ymm1
+	vextracti128 xmm1, ymm0, 1
+	vpaddd xmm0, xmm0, xmm1
+	call sum
+	xor edi, edi
+	call exit wrt ..plt
+
+; prints the sum of the lanes of xmm0
+sum:
+	vpshufd xmm1, xmm0, 0x4e
+	vpaddd xmm0, xmm0, xmm1
+	vpshufd xmm1, xmm0, 0xb1
+	vpaddd xmm0, xmm0, xmm1
+	vmovd esi, xmm0
+print:
+	sub rsp, 8
+	lea rdi, [rel format]
+	xor eax, eax
+	call printf wrt ..plt
+	add rsp, 8
+	ret
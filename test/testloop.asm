@@ -0,0 +1,49 @@
+; flags: -falign-loops=32
+section .data
+	fmt: db "%ld", 10, 0
+section .text
+global _start
+extern printf
+extern exit
+_start:
+	; sum of i * j for i and j from 1 to 100
+	xor r12, r12
+	mov ecx, 1
+	.outer:
+	mov edx, 1
+	.inner:
+	mov eax, ecx
+	imul eax, edx
+	add r12, rax
+	inc edx
+	cmp edx, 100
+	jbe .inner
+	inc ecx
+	cmp ecx, 100
+	jbe .outer
+	; forward targets are left alone
+	jmp .print
+	nop
+	.print:
+	mov rsi, r12
+	call print
+	; offsets of the loop heads from the start of the section, modulo 32
+	lea rsi, [rel _start.outer]
+	call offset
+	lea rsi, [rel _start.inner]
+	call offset
+	lea rsi, [rel _start.print]
+	call offset
+	mov edi, 0
+	call exit wrt ..plt
+offset:
+	lea rax, [rel _start]
+	sub rsi, rax
+	and rsi, 31
+print:
+	sub rsp, 8
+	lea rdi, [rel fmt]
+	xor eax, eax
+	call printf wrt ..plt
+	add rsp, 8
+	ret
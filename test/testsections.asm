@@ -0,0 +1,45 @@
+; flags: -ffunction-sections
+section .rodata.msg
+	fmt: db "%ld", 10, 0
+section .data.counter aw align=8
+	counter: dq 40
+section .bss.buf
+	buf: resb 64
+section .text.hot ax align=32
+; called from another section, its address is a multiple of 32
+bump:
+	mov rax, [rel counter]
+	inc rax
+	mov [rel counter], rax
+	ret
+section .text
+global _start
+global print
+extern printf
+extern exit
+_start:
+	call bump
+	call bump
+	mov rsi, [rel counter]
+	call print
+	; the buffer is zeroed and writable
+	lea rdi, [rel buf]
+	mov qword [rdi + 56], 7
+	mov rsi, [rdi + 56]
+	add rsi, [rdi]
+	call print
+	lea rsi, [rel bump]
+	and rsi, 31
+	call print
+	mov edi, 0
+	call exit wrt ..plt
+unused:
+	mov eax, 1
+	ret
+print:
+	sub rsp, 8
+	lea rdi, [rel fmt]
+	xor eax, eax
+	call printf wrt ..plt
+	add rsp, 8
+	ret
@@ -0,0 +1,39 @@
+; flags: -ffunction-sections -mbranches-within-32B-boundaries
+section .data
+	fmt: db "%ld", 10, 0
+section .text
+global _start
+extern printf
+extern exit
+_start:
+	; every function section keeps the 32 byte alignment the padding was computed for,
+	; first is 42 bytes long so second only starts at a multiple of 32 when it does
+	call first
+	mov rsi, rax
+	call print
+	lea rsi, [rel second]
+	and rsi, 31
+	call print
+	lea rsi, [rel third]
+	and rsi, 31
+	call print
+	mov edi, 0
+	call exit wrt ..plt
+first:
+	mov rax, 1
+	mov rax, 2
+	mov rax, 3
+	mov rax, 4
+	mov rax, 5
+	mov rax, 6
+second:
+	ret
+third:
+	ret
+print:
+	sub rsp, 8
+	lea rdi, [rel fmt]
+	xor eax, eax
+	call printf wrt ..plt
+	add rsp, 8
+	ret
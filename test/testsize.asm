@@ -0,0 +1,47 @@
+; flags: -Os
+section .data
+	fmt: db "%ld", 10, 0
+section .text
+global _start
+extern printf
+extern exit
+_start:
+	lea rsi, [rel corpus.g1]
+	lea rax, [rel corpus.g0]
+	sub rsi, rax
+	call print
+	lea rsi, [rel corpus.g2]
+	lea rax, [rel corpus.g1]
+	sub rsi, rax
+	call print
+	lea rsi, [rel corpus.g3]
+	lea rax, [rel corpus.g2]
+	sub rsi, rax
+	call print
+	mov edi, 0
+	call exit wrt ..plt
+print:
+	sub rsp, 8
+	lea rdi, [rel fmt]
+	xor eax, eax
+	call printf wrt ..plt
+	add rsp, 8
+	ret
+; never run, only its size is printed
+corpus:
+	.g0:
+	mov rax, 5
+	mov r9, 0xffffffff
+	add eax, 0xfffffff0
+	and rcx, 0x7f
+	push 200
+	.g1:
+	xor rax, rax
+	sub r10, r10
+	test rbx, 1
+	.g2:
+	vpor xmm1, xmm2, xmm9
+	vaddps ymm0, ymm1, ymm2
+	vpand ymm3, ymm3, ymm12
+	.g3:
+	ret
@@ -1,9 +1,505 @@
 #include "translate.hpp"
-#include "instr.dat"
+#include "table.hpp"
 #include "vex.hpp"
+#include "evex.hpp"
 
-void handle(std::string s, std::vector<std::string> args, const size_t linenum, size_t instr_cnt) {
+// relative branches take their immediate as a displacement from the end of the instruction
+static bool is_branch(const std::string &s) {
+	return s[0] == 'j' || s == "call" || s.starts_with("loop") || s == "xbegin";
+}
+
+// -Os, choose shorter equivalent forms
+bool optimize_size = false;
+// the last instruction refers to a symbol, its bytes depend on where it is
+bool uses_symbol = false;
+// bytes of the instructions that do not refer to a symbol, keyed on their lexed line
+static std::unordered_map<std::string, std::string> encode_cache;
+static const size_t max_cache_entries = 1 << 16;
+size_t cache_lookups = 0;
+size_t cache_hits = 0;
+
+// a piece of the text section whose size is only known once every label is: a branch to a symbol, alignment padding
+// or padding that keeps a branch off a 32-byte boundary
+struct text_item {
+	// offset and size in text_buffer as emitted
+	uint64_t offset = 0;
+	uint32_t size = 0;
+	// alignment of the padding, 0 for a branch, and the most bytes it may take
+	uint32_t align = 0;
+	uint32_t max_skip = 0;
+	// padding in front of a loop found by -falign-loops
+	bool loop = false;
+	// branch target and its rel8 and rel32 forms, nullptr if the instruction does not have one
+	uint32_t symbol = 0;
+	const instr_record *rel8 = nullptr;
+	const instr_record *rel32 = nullptr;
+	size_t linenum = 0;
+	// boundary padding: bytes of the instruction it may prefix, bytes of the branch or fused pair it protects,
+	// and the most prefixes that instruction takes
+	uint32_t lead = 0;
+	uint32_t span = 0;
+	uint32_t prefixes = 0;
+};
+static std::vector<text_item> text_items;
+// alignment of the text section, the padding inside it only lines up in the linked image when it is at least as large
+uint64_t text_align = 16;
+// least alignment of every code section, 32 when padding keeps branches within 32 byte boundaries
+uint64_t min_text_align = 16;
+// index in sections of the code section being filled
+uint32_t text_section = 0;
+
+// a label of the code section being filled, the others are only known to the linker
+static bool in_text(const symbol &sym) {
+	return sym.section == TEXT && sym.section_id == text_section;
+}
+
+// -falign-loops, alignment of the targets of backward branches and the most bytes it may take, off when 0
+std::pair<int, int> loop_align = {0, 0};
+static std::unordered_set<uint32_t> loop_heads;
+size_t aligned_loops = 0;
+size_t loop_padding = 0;
+
+// -mbranches-within-32B-boundaries
+bool align_branches = false;
+size_t boundary_prefixes = 0;
+size_t boundary_nops = 0;
+
+// the last instructions of the text section, a branch may be padded with prefixes on the one before it
+struct emitted_instr {
+	uint64_t offset = 0;
+	uint32_t size = 0;
+	// number of text items before the instruction
+	size_t items = 0;
+	bool prefixable = false;
+	// may be macro-fused with a following conditional jump
+	bool fusible = false;
+};
+static std::array<emitted_instr, 2> last_instrs;
+size_t short_branches = 0;
+size_t long_branches = 0;
+size_t resolved_relocations = 0;
+
+// a code section put aside while another one is filled
+struct text_state {
+	std::string buffer;
+	std::vector<reloc_entry> relocations;
+	std::vector<text_item> items;
+	std::array<emitted_instr, 2> last_instrs{};
+	uint64_t align = 0;
+};
+static std::unordered_map<uint32_t, text_state> parked_text;
+
+void add_reloc(const reloc_entry &reloc, const size_t linenum) {
+	uses_symbol = true;
+	symbol &sym = symbols[reloc.symbol];
+	// not defined yet, checked once the whole file has been read
+	if (sym.section == UNDEF && !sym.external && !sym.first_use)
+		sym.first_use = linenum;
+	relocations.push_back(reloc);
+	relocations.back().linenum = linenum;
+}
+
+// append the chosen encoding of an instruction to the text section, the addends of its
+// pc-relative relocations are made relative to the end of the instruction
+void emit_instr(const instr_bytes &instr, const size_t linenum) {
+	for (uint8_t i = 0; i < instr.num_relocs; i++) {
+		reloc_entry reloc = instr.relocs[i];
+		if (reloc.type != ABS)
+			reloc.addend -= instr.size - (reloc.offset - text_buffer.size());
+		add_reloc(reloc, linenum);
+	}
+	text_buffer.append((const char *)instr.bytes.data(), instr.size);
+}
+
+// bytes of padding needed at offset, none if it takes more than max_skip
+static uint32_t padding(uint64_t offset, uint32_t align, uint32_t max_skip) {
+	const uint32_t n = (align - offset % align) % align;
+	return n <= max_skip ? n : 0;
+}
+
+// bytes that move [offset, offset + span) to the next 32-byte boundary when it crosses or ends on one
+static uint32_t boundary_padding(uint64_t offset, uint32_t span) {
+	return offset / 32 != (offset + span) / 32 ? 32 - offset % 32 : 0;
+}
+
+// padding of the text section, it changes when the branches before it grow
+void align_text(int align, int max_skip) {
+	const uint32_t n = padding(text_buffer.size(), align, max_skip);
+	text_items.push_back({text_buffer.size(), n, (uint32_t)align, (uint32_t)max_skip});
+	fill_nops(text_buffer, n);
+	text_align = std::max<uint64_t>(text_align, align);
+}
+
+// the target of a backward branch heads a loop, it gets its padding once the branch is seen
+static void align_loop(const uint32_t id) {
+	const symbol &sym = symbols[id];
+	if (!in_text(sym) || !loop_heads.insert(id).second)
+		return;
+	text_item item;
+	item.offset = sym.offset;
+	item.align = loop_align.first;
+	item.max_skip = loop_align.second;
+	item.loop = true;
+	text_align = std::max<uint64_t>(text_align, item.align);
+	// in front of the boundary padding of the instruction at the label, which depends on it
+	text_items.insert(std::partition_point(text_items.begin(), text_items.end(), [&](const text_item &t) { return t.offset < sym.offset; }), item);
+	aligned_loops++;
+}
+
+// branches to labels are emitted in their shortest form and grown by relax_branches() once every label is known,
+// returns false if the instruction has no relative form
+static bool add_branch(const std::span<const instr_record> records, const uint32_t id, const size_t linenum) {
+	text_item item;
+	for (const instr_record &r : records) {
+		if (r.num_operands != 1 || r.operands[0].kind != 'I' || r.prefix || r.rex_w)
+			continue;
+		if (r.operands[0].size == 8)
+			item.rel8 = &r;
+		else if (r.operands[0].size == 32)
+			item.rel32 = &r;
+	}
+	if (!item.rel8 && !item.rel32)
+		return false;
+	uses_symbol = true;
+	symbol &sym = symbols[id];
+	if (sym.section == UNDEF && !sym.external && !sym.first_use)
+		sym.first_use = linenum;
+	const instr_record &r = item.rel8 ? *item.rel8 : *item.rel32;
+	item.offset = text_buffer.size();
+	item.size = r.opcode_size + r.operands[0].size / 8;
+	item.symbol = id;
+	item.linenum = linenum;
+	text_buffer.append(item.size, '\0');
+	text_items.push_back(item);
+	return true;
+}
+
+// grow the branches that do not reach their target until none does, starting from the short forms,
+// then lay out the text section again with the final sizes and move the labels and relocations
+void relax_branches() {
+	const size_t n = text_items.size();
+	if (n == 0)
+		return;
+	// size of each item, and the shift of everything after it
+	std::vector<uint32_t> size(n);
+	std::vector<int64_t> shift(n);
+	for (size_t i = 0; i < n; i++)
+		size[i] = text_items[i].size;
+	// offset in the new layout of a byte that is not inside an item,
+	// an instruction that received boundary prefixes starts at the first of them
+	auto new_offset = [&](uint64_t offset) -> uint64_t {
+		auto it = std::partition_point(text_items.begin(), text_items.end(), [&](const text_item &t) { return t.offset + t.size <= offset; });
+		if (it == text_items.begin())
+			return offset;
+		const size_t i = it - text_items.begin() - 1;
+		const text_item &t = text_items[i];
+		return offset + shift[i] - (t.span && t.offset == offset ? std::min(size[i], t.prefixes) : 0);
+	};
+	auto is_short = [&](size_t i) { return text_items[i].rel8 && size[i] == text_items[i].rel8->opcode_size + 1u; };
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		int64_t delta = 0;
+		for (size_t i = 0; i < n; i++) {
+			const text_item &t = text_items[i];
+			if (t.align) {
+				size[i] = padding(t.offset + delta, t.align, t.max_skip);
+			} else if (t.span) {
+				// the branch it protects is the next item when it goes to a label
+				uint32_t span = t.span;
+				if (i + 1 < n && text_items[i + 1].offset < t.offset + t.lead + t.span)
+					span += size[i + 1] - text_items[i + 1].size;
+				size[i] = boundary_padding(t.offset + delta + t.lead, span);
+			}
+			delta += (int64_t)size[i] - t.size;
+			shift[i] = delta;
+		}
+		for (size_t i = 0; i < n; i++) {
+			const text_item &t = text_items[i];
+			if (t.align || !is_short(i))
+				continue;
+			const symbol &sym = symbols[t.symbol];
+			const int64_t end = t.offset + shift[i] + size[i];
+			const int64_t disp = in_text(sym) ? (int64_t)new_offset(sym.offset) - end : INT64_MAX;
+			if ((int8_t)disp == disp)
+				continue;
+			if (!t.rel32)
+				cerr(t.linenum, "cible de branchement « " + sym.name + " » hors de portée");
+			size[i] = t.rel32->opcode_size + 4;
+			changed = true;
+		}
+	}
+
+	for (const uint32_t id : sections[text_section].labels)
+		if (in_text(symbols[id]))
+			symbols[id].offset = new_offset(symbols[id].offset);
+	for (reloc_entry &r : relocations)
+		r.offset = new_offset(r.offset);
+
+	std::string out;
+	out.reserve(text_buffer.size() + shift.back() + 1);
+	uint64_t prev = 0;
+	for (size_t i = 0; i < n; i++) {
+		const text_item &t = text_items[i];
+		out.append(text_buffer, prev, t.offset - prev);
+		prev = t.offset + t.size;
+		if (t.align) {
+			fill_nops(out, size[i]);
+			if (t.loop)
+				loop_padding += size[i];
+			continue;
+		}
+		if (t.span) {
+			// redundant cs prefixes on the instruction before the branch, nops for the rest
+			const uint32_t prefixes = std::min(size[i], t.prefixes);
+			fill_nops(out, size[i] - prefixes);
+			out.append(prefixes, '\x2e');
+			boundary_prefixes += prefixes;
+			boundary_nops += size[i] - prefixes;
+			continue;
+		}
+		const instr_record &r = is_short(i) ? *t.rel8 : *t.rel32;
+		out.append((const char *)r.opcode.data(), r.opcode_size);
+		const symbol &sym = symbols[t.symbol];
+		int32_t disp = 0;
+		if (in_text(sym))
+			disp = sym.offset - (out.size() + size[i] - r.opcode_size);
+		else
+			// outside of the section, left to the linker, through the PLT like GNU as for code of the file
+			// in another section so that the object still links into a shared library (COFF has no PLT)
+			relocations.emplace_back(out.size(), -4, output_format == ELF && sym.section == TEXT ? PLT : REL, t.symbol, 32, t.linenum);
+		if (is_short(i)) {
+			out += (char)disp;
+			short_branches++;
+		} else {
+			out.append((const char *)&disp, 4);
+			long_branches++;
+		}
+	}
+	out.append(text_buffer, prev);
+	text_buffer.swap(out);
+	std::vector<text_item>().swap(text_items);
+}
+
+// pc-relative references to labels of the same section are resolved once the layout is final,
+// only those to other sections and to external symbols reach the object file
+void resolve_relocations() {
+	size_t kept = 0;
+	for (const reloc_entry &r : relocations) {
+		const symbol &sym = symbols[r.symbol];
+		if (r.type != REL || !in_text(sym)) {
+			relocations[kept++] = r;
+			continue;
+		}
+		const int64_t value = sym.offset + r.addend - r.offset;
+		// relaxation keeps the short references in range, a value that does not fit is a bug
+		if (r.size == 8 ? (int8_t)value != value : (int32_t)value != value)
+			cerr(r.linenum, "référence à « " + sym.name + " » hors de portée");
+		if (r.size == 8) {
+			text_buffer[r.offset] = value;
+		} else {
+			const int32_t v = value;
+			memcpy(text_buffer.data() + r.offset, &v, 4);
+		}
+		resolved_relocations++;
+	}
+	relocations.resize(kept);
+}
+
+// make a code section the one instructions go to, the state of the current one is put aside
+void select_text(const uint32_t index) {
+	if (index == text_section)
+		return;
+	text_state &out = parked_text[text_section];
+	out.buffer.swap(text_buffer);
+	out.relocations.swap(relocations);
+	out.items.swap(text_items);
+	out.last_instrs = last_instrs;
+	out.align = text_align;
+	text_state &in = parked_text[index];
+	text_buffer.swap(in.buffer);
+	relocations.swap(in.relocations);
+	text_items.swap(in.items);
+	last_instrs = in.last_instrs;
+	text_align = std::max({in.align, (uint64_t)sections[index].align, min_text_align});
+	text_section = index;
+}
+
+// lay out every code section on its own and hand it to the object writers with its relocations
+void finish_text() {
+	for (uint32_t i = 0; i < sections.size(); i++) {
+		if (sections[i].kind != TEXT)
+			continue;
+		select_text(i);
+		relax_branches();
+		resolve_relocations();
+		sections[i].align = std::max(text_align, min_text_align);
+		sections[i].buffer.swap(text_buffer);
+		sections[i].relocs.swap(relocations);
+		text_buffer.clear();
+		relocations.clear();
+	}
+	parked_text.clear();
+}
+
+// encode an immediate at the end of tmp, symbols become relocations
+static void encode_imm(instr_bytes &tmp, std::pair<unsigned long long, short> a, const short size, const bool branch, const size_t linenum) {
+	const size_t offset = text_buffer.size() + tmp.size;
+	if (a.second == -1) {
+		cerr(linenum, error);
+	} else if (a.second == -4) {
+		tmp.relocate({offset, 0, PLT, (uint32_t)a.first, 32});
+		a.first = 0;
+	} else if (a.second <= -2) {
+		tmp.relocate({offset, 0, branch ? REL : ABS, (uint32_t)a.first, branch ? (short)32 : std::max(size, (short)32)});
+		a.first = 0;
+	}
+	for (int i = 0; i < size; i += 8)
+		tmp += (a.first >> i) & 0xff;
+}
+
+// the 8-bit immediates of these opcodes, and the 32-bit immediates of 64-bit operations, are sign-extended
+static bool sign_extended(const instr_record &r, const operand_pattern &imm, const short size) {
+	if (imm.size >= size)
+		return false;
+	return imm.size == 32 || (imm.size == 8 && (r.opcode[0] == 0x83 || r.opcode[0] == 0x6b || r.opcode[0] == 0x6a));
+}
+
+// a number fits an immediate of the line if the processor gives it back unchanged at the size of the operation
+static bool imm_fits(const std::string &s, const instr_record &r, const operand_pattern &imm, const uint64_t value, const short value_size) {
+	// size of the operation, push works on 64 bits
+	short size = s == "push" ? 64 : 0;
+	for (uint8_t i = 0; i < r.num_operands && !size; i++)
+		if (r.operands[i].kind != 'I' && r.operands[i].kind != 'L' && r.operands[i].size > 0)
+			size = r.operands[i].size;
+	if (size <= 0 || size > 64 || !sign_extended(r, imm, size))
+		return value_size <= imm.size;
+	// the number written at the size of the operation, negative numbers are in two's complement
+	if (size < 64 && value >> size && (int64_t)value < -(int64_t(1) << (size - 1)))
+		return false;
+	const int64_t v = (int64_t)(value << (64 - size)) >> (64 - size);
+	return (int64_t)(v << (64 - imm.size)) >> (64 - imm.size) == v;
+}
+
+// only commutative operations whose result does not depend on the order of the sources, even for NaNs
+static bool is_commutative_vex(const std::string &s) {
+	static const std::unordered_set<std::string> names = {
+		"vandps", "vandpd", "vorps", "vorpd", "vxorps", "vxorpd", "vpand", "vpor", "vpxor",
+		"vpaddb", "vpaddw", "vpaddd", "vpaddq", "vpaddsb", "vpaddsw", "vpaddusb", "vpaddusw",
+		"vpmullw", "vpmulld", "vpmulhw", "vpmulhuw", "vpmuludq", "vpmuldq", "vpavgb", "vpavgw",
+		"vpcmpeqb", "vpcmpeqw", "vpcmpeqd", "vpcmpeqq", "vpmaxsb", "vpmaxsw", "vpmaxsd", "vpmaxub",
+		"vpmaxuw", "vpmaxud", "vpminsb", "vpminsw", "vpminsd", "vpminub", "vpminuw", "vpminud",
+	};
+	return names.contains(s);
+}
+
+// -Os: rewrite the operands into an equivalent shorter form before the encodings are tried
+static void shorten_operands(const std::string &s, const std::span<const instr_record> records, std::vector<std::string> &args, std::vector<operand> &ops) {
+	if (ops.size() == 3 && records.front().vex) {
+		// the two-byte VEX prefix can not extend the r/m register, vvvv can
+		if (records.front().mmmmm == 1 && !records.front().w && ops[1].type == REG && ops[2].type == REG && ops[1].reg.num < 8 && ops[2].reg.num >= 8 && ops[2].reg.num < 16 && is_commutative_vex(s)) {
+			std::swap(ops[1], ops[2]);
+			std::swap(args[1], args[2]);
+		}
+		return;
+	}
+	if (ops.size() != 2 || ops[0].type != REG || ops[0].reg.type != GPR)
+		return;
+	const reg_info r = ops[0].reg;
+	auto narrow = [&](short size) {
+		args[0] = reg_name(r.num, size);
+		ops[0] = parse_operand(args[0]);
+	};
+	const uint64_t v = ops[1].imm.first;
+	if (ops[1].type == IMM && ops[1].imm.second > 0 && (s == "mov" || s == "and" || s == "test") && r.size == 64) {
+		// writing a 32-bit register clears the upper half, and the flags are the same when bit 31 is clear
+		if (s == "mov" ? v <= 0xffffffff : v < 0x80000000)
+			narrow(32);
+	}
+	if (ops[1].type == IMM && ops[1].imm.second > 0 && s == "test" && ops[0].size >= 16 && v < 0x80 && !r.high)
+		narrow(8);
+	if (ops[1].type == REG && (s == "xor" || s == "sub") && r.size == 64 && ops[1].reg.size == 64 && ops[1].reg.num == r.num) {
+		// zeroing idiom
+		narrow(32);
+		args[1] = args[0];
+		ops[1] = ops[0];
+	}
+}
+
+// cmp, test, add, sub, and, inc and dec without a memory operand are fused with a following conditional jump
+static bool is_fusible(const std::string &s, const std::span<const std::string_view> args) {
+	static const std::unordered_set<std::string> names = {"cmp", "test", "add", "sub", "and", "inc", "dec"};
+	return names.contains(s) && std::none_of(args.begin(), args.end(), [](std::string_view a) { return a.find('[') != std::string_view::npos; });
+}
+
+// a redundant segment prefix does not change a legacy encoded instruction that is not a branch
+static bool is_prefixable(const std::string &s, const size_t size) {
+	if (is_branch(s) || s == "ret" || size >= instr_bytes::max_size)
+		return false;
+	const std::span<const instr_record> records = find_instr(s);
+	return !records.empty() && !records.front().vex && !records.front().evex;
+}
+
+// jumps and macro-fused pairs get padding that keeps them off 32-byte boundaries,
+// its size is only known once the branches are relaxed
+static void track_instr(const std::string &s, const std::span<const std::string_view> args, const size_t start, const size_t items) {
+	const uint32_t size = text_buffer.size() - start;
+	const emitted_instr instr{start, size, items, is_prefixable(s, size), is_fusible(s, args)};
+	// nothing is emitted between the two instructions
+	auto adjacent = [](const emitted_instr &a, const emitted_instr &b) {
+		return a.offset + a.size == b.offset && a.items == b.items;
+	};
+	if (s[0] == 'j') {
+		emitted_instr first = instr;
+		emitted_instr prev = last_instrs[0];
+		if (s != "jmp" && last_instrs[0].fusible && adjacent(last_instrs[0], instr)) {
+			first = last_instrs[0];
+			prev = last_instrs[1];
+		}
+		text_item item;
+		item.offset = first.offset;
+		item.span = text_buffer.size() - first.offset;
+		if (prev.prefixable && adjacent(prev, first)) {
+			item.offset = prev.offset;
+			item.lead = prev.size;
+			item.prefixes = std::min<uint32_t>(5, instr_bytes::max_size - prev.size);
+		}
+		// after the padding already at that offset, before the branch
+		text_items.insert(std::partition_point(text_items.begin(), text_items.end(), [&](const text_item &t) {
+			return t.offset < item.offset || (t.offset == item.offset && t.size == 0);
+		}), item);
+	}
+	last_instrs = {instr, last_instrs[0]};
+}
+
+void handle_line(const std::string &key, const std::string &s, const std::span<const std::string_view> arg_views, const size_t linenum) {
+	const size_t start = text_buffer.size();
+	const size_t items = text_items.size();
+	cache_lookups++;
+	auto it = encode_cache.find(key);
+	if (it != encode_cache.end()) {
+		cache_hits++;
+		text_buffer += it->second;
+	} else {
+		handle(s, std::vector<std::string>(arg_views.begin(), arg_views.end()), linenum);
+		if (!uses_symbol && encode_cache.size() < max_cache_entries)
+			encode_cache.emplace(key, text_buffer.substr(start));
+	}
+	if (align_branches)
+		track_instr(s, arg_views, start, items);
+}
+
+// a line of the table that matches the operands, with the operands it encodes
+struct candidate {
+	instr_record record;
+	short size;
+	std::vector<operand> ops;
+	std::vector<std::pair<enum op_type, short>> types;
+};
+
+void handle(std::string s, std::vector<std::string> args, const size_t linenum) {
 	error = "";
+	uses_symbol = false;
 	bool prefix = false;
 	// handle prefixes (lock, repne, repe)
 	while (true) {
@@ -26,114 +522,87 @@ void handle(std::string s, std::vector<std::string> args, const size_t linenum,
 		s = args.front().substr(0, i);
 		args.front() = args.front().substr(i + 1);
 	}
-	char *l = map;
-	char *r = map + map_size - 1;
-	// go to the start of the section
-	while (r[-1] != '\n' || r[-2] != '\n')
-		r--;
-	// binary search for the section that matches
-	while (l < r && l < map + map_size - 2 && r > map + 2) {
-		char *m = l + (r - l) / 2;
-		while (m >= map + 2 && (m[-1] != '\n' || m[-2] != '\n'))
-			m--;
-		if (strncmp(m, s.c_str(), s.size()) == 0 && m[s.size()] == ' ') {
-			l = m;
-			break;
-		} else if (strncmp(m, s.c_str(), s.size()) < 0) {
-			l = m + 6;
-			while (l <= map + map_size - 2 && (l[-1] != '\n' || l[-2] != '\n'))
-				l++;
-		} else {
-			r = m - 6;
-			while (r >= map + 2 && (r[-1] != '\n' || r[-2] != '\n'))
-				r--;
-		}
+	const std::span<const instr_record> records = find_instr(s);
+	if (records.empty())
+		cerr(linenum, "instruction inconnue « " + s + " »");
+	evex_decorators deco;
+	parse_decorators(args, deco, linenum);
+	std::vector<operand> ops;
+	for (const std::string &arg : args) {
+		ops.push_back(parse_operand(arg));
+		if (ops.back().type == INVALID)
+			cerr(linenum, error.empty() ? "opérande invalide « " + arg + " »" : error);
 	}
-	// store all lines that match
-	while ((strncmp(l, s.c_str(), s.size()) != 0 || l[s.size()] != ' ') && l < map + map_size)
-		l++;
-	if (l >= map + map_size - 1 || *(l - 1) != '\n') {
-		handle_vex(s, args, linenum, prefix);
+	if (optimize_size)
+		shorten_operands(s, records, args, ops);
+	if (records.front().vex || records.front().evex) {
+		// the EVEX lines follow the VEX lines, the shorter VEX prefix is used when it can encode the operands
+		const auto evex = std::find_if(records.begin(), records.end(), [](const instr_record &r) { return r.evex; });
+		if (evex == records.begin() || (evex != records.end() && needs_evex(ops, deco))) {
+			handle_evex(ops, deco, linenum, prefix, std::span(evex, records.end()));
+			return;
+		}
+		if (deco.mask || deco.broadcast || deco.rounding != -1)
+			cerr(linenum, "impossible d'utiliser un décorateur avec une instruction VEX");
+		handle_vex(s, ops, linenum, prefix, std::span(records.begin(), evex));
 		return;
 	}
-	r = std::find(l + 1, map + map_size, '\n');
-	std::vector<std::string> matches;
-	while (*l != '\n' && r != map + map_size) {
-		matches.emplace_back(l, r);
-		l = r + 1;
-		r = std::find(l, map + map_size, '\n');
+	for (const operand &op : ops) {
+		if (op.type == MEM && op.mem.vsib)
+			cerr(linenum, "impossible d'utiliser un index vectoriel avec cette instruction");
+	}
+	if (needs_evex(ops, deco))
+		cerr(linenum, "combination d'opcode et des opérandes invalide");
+	const bool branch = is_branch(s);
+	// labels of the text section, known or not yet defined
+	if (branch && ops.size() == 1 && ops[0].type == IMM && (ops[0].imm.second == -3 || ops[0].imm.second == -6) && add_branch(records, ops[0].imm.first, linenum)) {
+		if (loop_align.first && s != "call")
+			align_loop(ops[0].imm.first);
+		return;
 	}
 	std::vector<std::pair<enum op_type, short>> types;
-	for (const std::string &arg : args) {
-		enum op_type type = get_optype(arg);
-		if (type == REG) {
-			types.emplace_back(REG, reg_size(arg));
-		} else if (type == MEM) {
-			types.emplace_back(MEM, mem_size(arg));
-		} else if (type == IMM) {
-			auto tmp = parse_imm(arg);
+	for (const operand &op : ops) {
+		if (op.type == REG) {
+			types.emplace_back(REG, op.size);
+		} else if (op.type == MEM) {
+			types.emplace_back(MEM, op.size);
+		} else if (op.type == IMM) {
+			const auto &tmp = op.imm;
+			if (tmp.second <= -2)
+				uses_symbol = true;
 			if (tmp.second == -1) {
 				cerr(linenum, error);
-			} else if (tmp.second == -3) {
-				if (reloc_table.count(text_labels[tmp.first])) {
-					int32_t off = reloc_table.at(text_labels.at(tmp.first)) - text_buffer.size() - 5;
-					if ((int8_t)off == off) {
-						types.emplace_back(IMM, 8);
-					} else {
-						types.emplace_back(IMM, 32);
-						tmp.first = 0;
-					}
-				} else {
-					if (text_labels_instr[tmp.first] - instr_cnt <= 9) {
-						types.emplace_back(IMM, 8);
-					} else {
-						types.emplace_back(IMM, 32);
-						tmp.first = 0;
-					}
-				}
-			} else if (tmp.second == -2 || tmp.second == -4) {
+			} else if (tmp.second <= -2) {
 				types.emplace_back(IMM, 32);
 			} else {
 				types.emplace_back(IMM, tmp.second);
 			}
-		} else {
-			cerr(linenum, "opérande invalide « " + arg + " »");
 		}
 	}
-	std::vector<std::pair<std::vector<std::string>, short>> valid;
-	for (size_t i = 0; i < matches.size(); i++) {
-		std::string &line = matches[i];
-		std::vector<std::string> tokens;
-		size_t l = 0;
-		size_t r = line.find(' ');
-		while (r != std::string::npos) {
-			tokens.push_back(line.substr(l, r - l));
-			l = r + 1;
-			r = line.find(' ', l);
-		}
-		tokens.push_back(line.substr(l));
-		if (tokens.size() != args.size() + 2)
+	std::vector<candidate> valid;
+	for (const instr_record &record : records) {
+		if (record.num_operands != args.size())
 			continue;
 		bool matched = true;
 		short size = 0;
 		for (size_t j = 0; j < args.size(); j++) {
-			std::string &token = tokens[j + 1];
-			if (token[0] == 'R') {
+			const operand_pattern &op = record.operands[j];
+			if (op.kind == 'R') {
 				if (types[j].first != REG) {
 					matched = false;
 					break;
 				}
-				if (types[j].second != _sizes[token[1] - 'A']) {
+				if (types[j].second != op.size) {
 					matched = false;
 					break;
 				}
-				size += _sizes[token[1] - 'A'];
-			} else if (token[0] == 'M') {
+				size += op.size;
+			} else if (op.kind == 'M') {
 				if (types[j].first != MEM && types[j].first != REG) {
 					matched = false;
 					break;
 				}
-				if (token[1] == '*') {
+				if (op.letter == '*') {
 					if (types[j].first != MEM) {
 						matched = false;
 						break;
@@ -141,57 +610,53 @@ void handle(std::string s, std::vector<std::string> args, const size_t linenum,
 						continue;
 					}
 				}
-				if (types[j].second != -1 && types[j].second != _sizes[token[1] - 'A']) {
+				if (types[j].second != -1 && types[j].second != op.size) {
 					matched = false;
 					break;
 				}
-				size += _sizes[token[1] - 'A'];
-			} else if (token[0] == 'I') {
+				size += op.size;
+			} else if (op.kind == 'I') {
 				if (types[j].first != IMM) {
 					matched = false;
 					break;
 				}
-				if (types[j].second > _sizes[token[1] - 'A']) {
+				if (ops[j].imm.second > 0 ? !imm_fits(s, record, op, ops[j].imm.first, types[j].second) : types[j].second > op.size) {
 					matched = false;
 					break;
 				}
-			} else if (token[0] == 'L') {
-				if (std::stoi(args[j]) != std::stoi(token.substr(1))) {
+			} else if (op.kind == 'L') {
+				if (types[j].first != IMM || ops[j].imm.first != (uint64_t)op.value) {
 					matched = false;
 					break;
 				}
-			} else if (isdigit(token[0]) || (token[0] >= 'a' && token[0] <= 'f')) {
-				if (reg_num(args[j]) != std::stoi(token.substr(0, 1), nullptr, 16)) {
+			} else if (op.kind == 'F') {
+				if (ops[j].reg.num != op.value) {
 					matched = false;
 					break;
 				}
-				if (types[j].second != _sizes[token[1] - 'A']) {
+				if (types[j].second != op.size) {
 					matched = false;
 					break;
 				}
-				size += _sizes[token[1] - 'A'];
-			} else {
-				std::cerr << "Erreur : ensemble d'instructions mal configurée" << std::endl;
+				size += op.size;
 			}
 		}
 		if (matched) {
+			candidate &c = valid.emplace_back(record, size, ops, types);
+			instr_record &p = c.record;
 			for (size_t j = 0; j < args.size(); j++) {
-				if (types[j].second == -1 && tokens[j + 1][1] == '*')
-					types[j].second = 8;
+				if (c.types[j].second == -1 && p.operands[j].letter == '*')
+					c.types[j].second = 8;
 			}
-			std::vector<short> del;
-			for (size_t j = 1; j <= args.size(); j++) {
-				if (isdigit(tokens[j][0]) || (tokens[j][0] >= 'a' && tokens[j][0] <= 'f'))
-					del.push_back(j - 1);
-				else if (tokens[j][0] == 'L')
-					del.push_back(j - 1);
-			}
-			for (auto d : del) {
-				args.erase(args.begin() + d);
-				types.erase(types.begin() + d);
-				tokens.erase(tokens.begin() + d + 1);
+			// fixed registers and numbers are part of the opcode, they are removed from this candidate only
+			for (size_t j = args.size(); j-- > 0;) {
+				if (p.operands[j].kind == 'F' || p.operands[j].kind == 'L') {
+					c.ops.erase(c.ops.begin() + j);
+					c.types.erase(c.types.begin() + j);
+					std::copy(p.operands.begin() + j + 1, p.operands.end(), p.operands.begin() + j);
+					p.num_operands--;
+				}
 			}
-			valid.emplace_back(tokens, size);
 		}
 	}
 	if (valid.empty())
@@ -202,227 +667,127 @@ void handle(std::string s, std::vector<std::string> args, const size_t linenum,
 				cerr(linenum, "taille d'opération non spécifiée");
 		}
 	} else {
-		for (size_t i = 0; i < args.size(); i++) {
-			if (types[i].first == MEM && types[i].second == -1)
-				types[i].second = _sizes[valid[0].first[i + 1][1] - 'A'];
+		for (size_t i = 0; i < valid[0].types.size(); i++) {
+			if (valid[0].types[i].first == MEM && valid[0].types[i].second == -1)
+				valid[0].types[i].second = valid[0].record.operands[i].size;
 		}
 	}
-	if (types.size() == 2 && types[0].first == REG && types[1].first == REG) {
-		types[1].first = MEM;
-		for (auto &p : valid) {
-			if (p.first[1].front() != 'M')
-				p.first[2].front() = 'M';
+	for (candidate &c : valid) {
+		if (c.types.size() == 2 && c.types[0].first == REG && c.types[1].first == REG) {
+			c.types[1].first = MEM;
+			if (c.record.operands[0].kind != 'M')
+				c.record.operands[1].kind = 'M';
 		}
 	}
-	std::string best = "";
-	size_t bestlen = -1;
-	std::vector<reloc_entry> bestreloc;
-	for (auto &p : valid) {
-		std::vector<reloc_entry> reloc;
-		std::string tmp = "";
-		if (p.first.back()[0] == 'p') {
-			tmp += std::stoi(p.first.back().substr(1, 2), nullptr, 16);
-			p.first.back() = p.first.back().substr(3);
-		}
+	instr_bytes best;
+	best.size = instr_bytes::max_size + 1;
+	for (const candidate &match : valid) {
+		const instr_record &p = match.record;
+		const std::vector<operand> &ops = match.ops;
+		const std::vector<std::pair<enum op_type, short>> &types = match.types;
+		instr_bytes tmp;
+		const std::string_view opcode((const char *)p.opcode.data(), p.opcode_size);
+		if (p.prefix)
+			tmp += p.prefix;
 		if (types.size() == 0) {
-			if (p.first.back()[0] == 'w') {
+			if (p.rex_w)
 				tmp += 0x48;
-				p.first.back() = p.first.back().substr(1);
-			}
-			for (size_t i = 0; i < p.first.back().size(); i += 2)
-				tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
+			tmp += opcode;
 		} else if (types.size() == 1) {
 			if (types[0].second == 16)
 				tmp += 0x66;
 			if (types[0].first == REG) {
-				short a1 = reg_num(args[0]);
-				a1 += (args[0][1] == 'h') * 4;
-				size_t i = p.first.back()[0] == 'w';
-				if (args[0][1] == 'h' && i)
+				const reg_info &r = ops[0].reg;
+				short a1 = r.num + r.high * 4;
+				const bool w = p.rex_w;
+				if (r.high && w)
 					cerr(linenum, "impossible d'utiliser un haut-demi registre avec une prefixe REX");
-				if ((i && s != "push" && s != "pop") || (types[0].second == 8 && args[0][1] != 'h' && a1 >= 4) || a1 >= 8)
-					tmp += 0x40 | (i << 3) | (a1 >= 8);
-				short reg = 0;
-				for (; i < p.first.back().size(); i += 2) {
-					if (p.first.back()[i] == '/') {
-						reg = std::stoi(p.first.back().substr(i + 1, 1));
-						break;
-					}
-					tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-				}
-				if (p.first[1][0] == 'R')
+				if ((w && s != "push" && s != "pop") || r.rex)
+					tmp += 0x40 | (w << 3) | (a1 >= 8);
+				tmp += opcode;
+				if (p.operands[0].kind == 'R')
 					tmp.back() += a1 & 7;
 				else
 					tmp += 0xc0 | (a1 & 7);
-				if (reg != -1)
-					tmp.back() |= reg << 3;
-			} else if (p.first[1][0] == 'M') {
-				short s1 = _sizes[p.first[1][1] - 'A'];
-				size_t w = p.first.back()[0] == 'w';
-				mem_output *data = parse_mem(args[0], s1);
-				if (data == nullptr) {
-					if (error.empty())
-						error = "mode d'adressage invalide";
-					cerr(linenum, error);
-				}
-				if (data->prefix)
-					tmp += data->prefix;
-				if (data->rex)
-					tmp += data->rex;
-				else if (w)
+				if (p.digit != -1)
+					tmp.back() |= p.digit << 3;
+			} else if (p.operands[0].kind == 'M') {
+				mem_output data = ops[0].mem;
+				if (data.prefix)
+					tmp += data.prefix;
+				if (data.rex)
+					tmp += data.rex;
+				else if (p.rex_w)
 					tmp += 0x48;
-				short reg = 0;
-				for (size_t i = w; i < p.first.back().size(); i += 2) {
-					if (p.first.back()[i] == '/') {
-						reg = std::stoi(p.first.back().substr(i + 1, 1));
-						break;
-					}
-					tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-				}
-				tmp += (uint8_t)data->rm | (reg << 3);
-				if (data->sib != 0x7fff)
-					tmp += data->sib;
+				tmp += opcode;
+				tmp += (uint8_t)data.rm | (p.digit == -1 ? 0 : p.digit << 3);
+				if (data.sib != 0x7fff)
+					tmp += data.sib;
 
-				if (data->reloc.second != NONE) {
-					reloc.emplace_back(text_buffer.size() + tmp.size(), data->offset, data->reloc.second, data->reloc.first, 32);
-					data->offset = 0;
+				if (data.reloc.second != NONE) {
+					tmp.relocate({text_buffer.size() + tmp.size, data.offset, data.reloc.second, data.reloc.first, 32});
+					data.offset = 0;
 				}
 
-				for (int i = 0; i < data->offsize; i += 8)
-					tmp += (data->offset >> i) & 0xff;
-
-				delete data;
-			} else if (p.first[1][0] == 'I') {
-				auto a1 = parse_imm(args[0]);
-				size_t i = p.first.back()[0] == 'w';
-				if (i)
+				for (int i = 0; i < data.offsize; i += 8)
+					tmp += (data.offset >> i) & 0xff;
+			} else if (p.operands[0].kind == 'I') {
+				if (p.rex_w)
 					tmp += 0x48;
-				for (; i < p.first.back().size(); i += 2) {
-					if (p.first.back()[i] == '/') {
-						tmp += std::stoi(p.first.back().substr(i + 1, 1)) << 3;
-						break;
-					}
-					tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-				}
-				if (a1.second == -1) {
-					cerr(linenum, error);
-				} else if (a1.second == -2) {
-					reloc.emplace_back(text_buffer.size() + tmp.size(), 0, ABS, args[0], 32);
-				} else if (a1.second == -3) {
-					if (reloc_table.count(text_labels[a1.first])) {
-						int32_t off = reloc_table.at(text_labels.at(a1.first)) - text_buffer.size() - 1 - _sizes[p.first[1][1] - 'A'] / 8;
-						if ((int8_t)off == off) {
-							a1.first = off;
-						} else {
-							reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a1.first], 32);
-							a1.first = 0;
-						}
-					} else {
-						if (text_labels_instr[a1.first] - instr_cnt <= 9) {
-							reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a1.first], 8);
-							a1.first = 0;
-						} else {
-							reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a1.first], 32);
-							a1.first = 0;
-						}
-					}
-				} else if (a1.second == -4) {
-					reloc.emplace_back(text_buffer.size() + tmp.size(), 0, PLT, args[0].substr(0, args[0].size() - 10), 32);
-				} else if (a1.second == -5) {
-					reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, extern_labels[a1.first], 32);
-					a1.first = 0;
-				}
-				for (int i = 0; i < _sizes[p.first[1][1] - 'A']; i += 8)
-					tmp += (a1.first >> i) & 0xff;
+				tmp += opcode;
+				if (p.digit != -1)
+					tmp += p.digit << 3;
+				encode_imm(tmp, ops[0].imm, p.operands[0].size, branch, linenum);
 			}
 		} else if (types.size() >= 2) {
 			// index, size
 			std::pair<short, short> reg{-1, -1};
 			std::pair<short, short> mem{-1, -1};
 			std::pair<short, short> imm{-1, -1};
-			for (size_t i = 1; i <= args.size(); i++) {
-				if (p.first[i][0] == 'R')
+			for (size_t i = 1; i <= ops.size(); i++) {
+				if (p.operands[i - 1].kind == 'R')
 					reg = {i, types[i - 1].second};
-				else if (p.first[i][0] == 'M')
+				else if (p.operands[i - 1].kind == 'M')
 					mem = {i, types[i - 1].second};
-				else if (p.first[i][0] == 'I')
+				else if (p.operands[i - 1].kind == 'I')
 					imm = {i, types[i - 1].second};
 			}
-			if (p.first[1][1] == 'W' || p.first[2][1] == 'W')
+			if (p.operands[0].letter == 'W' || p.operands[1].letter == 'W')
 				tmp += 0x66;
 			if (mem.first == -1) {
-				short a1 = reg_num(args[reg.first - 1]);
-				size_t i = p.first.back()[0] == 'w';
-				if (args[reg.first - 1][1] == 'h' && i)
+				const reg_info &r = ops[reg.first - 1].reg;
+				short a1 = r.num + r.high * 4;
+				const bool w = p.rex_w;
+				if (r.high && w)
 					cerr(linenum, "impossible d'utiliser un haut-demi registre avec une prefixe REX");
-				if (i || (a1 & 8))
-					tmp += 0x40 | (i << 3) | (a1 >= 8);
-				int reg = 0x7fff;
-				for (; i < p.first.back().size(); i += 2) {
-					if (p.first.back()[i] == '/') {
-						reg = std::stoi(p.first.back().substr(i + 1, 1));
-						break;
-					}
-					tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-				}
-				if (reg == 0x7fff)
+				if (w || r.rex)
+					tmp += 0x40 | (w << 3) | (a1 >= 8);
+				tmp += opcode;
+				if (p.digit == -1)
 					tmp.back() += a1 & 7;
 				else
-					tmp.back() += 0xc0 | (reg << 3) | (a1 & 7);
-				auto a2 = parse_imm(args[imm.first - 1]);
-				short s2 = _sizes[p.first[imm.first][1] - 'A'];
-				if (a2.second == -1) {
-					cerr(linenum, error);
-				} else if (a2.second == -2) {
-					reloc.emplace_back(text_buffer.size() + tmp.size(), 0, ABS, args[imm.first - 1], std::max(s2, (short)32));
-				} else if (a2.second == -3) {
-					if (reloc_table.count(text_labels[a2.first])) {
-						int32_t off = reloc_table.at(text_labels.at(a2.first)) - text_buffer.size() - 1 - _sizes[p.first[1][1] - 'A'] / 8;
-						if ((int8_t)off == off) {
-							a2.first = off;
-						} else {
-							reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a2.first], 32);
-							a2.first = 0;
-						}
-					} else {
-						if (text_labels_instr[a2.first] - instr_cnt <= 9) {
-							reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a2.first], 8);
-							a2.first = 0;
-						} else {
-							reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a2.first], 32);
-							a2.first = 0;
-						}
-					}
-				} else if (a2.second == -5) {
-					reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, extern_labels[a2.first], 32);
-					a2.first = 0;
-				}
-				for (int i = 0; i < s2; i += 8)
-					tmp += (a2.first >> i) & 0xff;
+					tmp.back() += 0xc0 | (p.digit << 3) | (a1 & 7);
+				encode_imm(tmp, ops[imm.first - 1].imm, p.operands[imm.first - 1].size, branch, linenum);
 			} else {
 				short rex = 0;
 				short rm = 0x7fff;
 				short sib = 0x7fff;
-				mem_output *data;
+				mem_output data;
 				if (mem.first != -1) {
-					short s1 = mem.second;
-					data = parse_mem(args[mem.first - 1], s1);
-					if (data == nullptr) {
-						if (error.empty())
-							error = "mode d'adressage invalide";
-						cerr(linenum, error);
-					}
-					if (data->prefix)
-						tmp += data->prefix;
-					rex = data->rex;
-					rm = data->rm;
-					sib = data->sib;
+					data = ops[mem.first - 1].mem;
+					if (data.prefix)
+						tmp += data.prefix;
+					rex = data.rex;
+					rm = data.rm;
+					sib = data.sib;
 				}
-				if (p.first.back()[0] == 'w')
+				if (p.rex_w)
 					rex |= 0x48;
+				reg_info r;
 				if (reg.first != -1) {
-					short a1 = reg_num(args[reg.first - 1]);
-					if (a1 & 8)
+					r = ops[reg.first - 1].reg;
+					short a1 = r.num + r.high * 4;
+					if (r.rex)
 						rex |= 0x40 | ((a1 & 8) >> 1);
 					if (rm == 0x7fff)
 						rm = 0xc0 | ((a1 & 7) << 3);
@@ -430,80 +795,36 @@ void handle(std::string s, std::vector<std::string> args, const size_t linenum,
 						rm |= (a1 & 7) << 3;
 				}
 				if (rex != 0) {
-					if (reg.first != -1)
-						if (args[reg.first - 1][1] == 'h')
-							cerr(linenum, "impossible d'utiliser un haut-demi registre avec une prefixe REX");
+					if (r.high)
+						cerr(linenum, "impossible d'utiliser un haut-demi registre avec une prefixe REX");
 					tmp += rex;
 				}
-				for (size_t i = p.first.back()[0] == 'w'; i < p.first.back().size(); i += 2) {
-					if (p.first.back()[i] == '/') {
-						rm |= std::stoi(p.first.back().substr(i + 1, 1)) << 3;
-						break;
-					}
-					tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-				}
+				tmp += opcode;
+				if (p.digit != -1)
+					rm |= p.digit << 3;
 				if (rm != 0x7fff)
 					tmp += rm;
 				if (sib != 0x7fff)
 					tmp += sib;
 
-				if (data->reloc.second != NONE) {
-					reloc.emplace_back(text_buffer.size() + tmp.size(), data->offset, data->reloc.second, data->reloc.first, 32);
-					data->offset = 0;
+				if (data.reloc.second != NONE) {
+					tmp.relocate({text_buffer.size() + tmp.size, data.offset, data.reloc.second, data.reloc.first, 32});
+					data.offset = 0;
 				}
 
-				for (int i = 0; i < data->offsize; i += 8)
-					tmp += (data->offset >> i) & 0xff;
-
-				delete data;
-
-				if (imm.first != -1) {
-					auto a1 = parse_imm(args[imm.first - 1]);
-					short s1 = _sizes[p.first[imm.first][1] - 'A'];
-					if (a1.second == -1) {
-						cerr(linenum, error);
-					} else if (a1.second == -2) {
-						reloc.emplace_back(text_buffer.size() + tmp.size(), 0, ABS, args[imm.first - 1], std::max(s1, (short)32));
-					} else if (a1.second == -3) {
-						if (reloc_table.count(text_labels[a1.first])) {
-							int32_t off = reloc_table.at(text_labels.at(a1.first)) - text_buffer.size() - 1 - _sizes[p.first[1][1] - 'A'] / 8;
-							if ((int8_t)off == off) {
-								a1.first = off;
-							} else {
-								reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a1.first], 32);
-								a1.first = 0;
-							}
-						} else {
-							if (text_labels_instr[a1.first] - instr_cnt <= 9) {
-								reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a1.first], 8);
-								a1.first = 0;
-							} else {
-								reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, text_labels[a1.first], 32);
-								a1.first = 0;
-							}
-						}
-					} else if (a1.second == -5) {
-						reloc.emplace_back(text_buffer.size() + tmp.size(), 0, REL, extern_labels[a1.first], 32);
-						a1.first = 0;
-					}
-					for (int i = 0; i < s1; i += 8)
-						tmp += (a1.first >> i) & 0xff;
-				}
+				for (int i = 0; i < data.offsize; i += 8)
+					tmp += (data.offset >> i) & 0xff;
+
+				if (imm.first != -1)
+					encode_imm(tmp, ops[imm.first - 1].imm, p.operands[imm.first - 1].size, branch, linenum);
 			}
 		}
-		if (tmp.size() <= bestlen) {
+		if (tmp.size <= instr_bytes::max_size && tmp.size <= best.size)
 			best = tmp;
-			bestlen = tmp.size();
-			bestreloc = reloc;
-		}
-		if (bestlen == 1)
+		if (best.size == 1)
 			break;
 	}
-	for (auto reloc : bestreloc) {
-		if (reloc.type != ABS)
-			reloc.addend -= best.size() - (reloc.offset - text_buffer.size());
-		relocations.push_back(reloc);
-	}
-	for (size_t i = 0; i < best.size(); i++)
-		text_buffer.push_back(best[i]);
+	if (best.size > instr_bytes::max_size)
+		cerr(linenum, "instruction trop longue");
+	emit_instr(best, linenum);
 }
@@ -6,17 +6,38 @@
 #include "utility.hpp"
 
 extern void cerr(const int i, const std::string &s);
+extern void fill_nops(std::string &, size_t);
 
-extern std::vector<std::string> text_labels;
-extern std::unordered_map<std::string, size_t> text_labels_map;
 extern std::string text_buffer;
-extern std::vector<std::string> extern_labels;
-extern std::unordered_map<std::string, size_t> extern_labels_map;
-extern std::vector<size_t> text_labels_instr;
-extern std::unordered_map<std::string, uint64_t> reloc_table;
 extern std::vector<reloc_entry> relocations;
+extern std::vector<section_info> sections;
 extern std::string error;
+extern bool optimize_size;
+extern format output_format;
+extern size_t cache_lookups;
+extern size_t cache_hits;
 
-void handle(std::string, std::vector<std::string>, const size_t, const size_t);
+extern size_t short_branches;
+extern size_t long_branches;
+extern size_t resolved_relocations;
+extern std::pair<int, int> loop_align;
+extern size_t loop_padding;
+extern size_t aligned_loops;
+extern bool align_branches;
+extern uint64_t text_align;
+extern uint64_t min_text_align;
+extern uint32_t text_section;
+extern size_t boundary_prefixes;
+extern size_t boundary_nops;
+
+void add_reloc(const reloc_entry &, const size_t);
+void emit_instr(const instr_bytes &, const size_t);
+void align_text(int, int);
+void relax_branches();
+void resolve_relocations();
+void select_text(const uint32_t);
+void finish_text();
+void handle(std::string, std::vector<std::string>, const size_t);
+void handle_line(const std::string &, const std::string &, const std::span<const std::string_view>, const size_t);
 
 #endif
@@ -2,20 +2,119 @@
 
 std::string error;
 
+// registers are found with a perfect hash of their name packed in an integer, chosen when compiling
+struct reg_entry {
+	std::string_view name;
+	reg_info info;
+};
+
+static constexpr std::array<const char *, 16> reg_names[] = {
+	{"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"},
+	{"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+	{"ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"},
+	{"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"},
+	{"xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"},
+	{"ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7", "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15"},
+	{"zmm0", "zmm1", "zmm2", "zmm3", "zmm4", "zmm5", "zmm6", "zmm7", "zmm8", "zmm9", "zmm10", "zmm11", "zmm12", "zmm13", "zmm14", "zmm15"},
+};
+static constexpr short reg_sizes[] = {64, 32, 16, 8, 128, 256, 512};
+static constexpr reg_class reg_classes[] = {GPR, GPR, GPR, GPR, XMM, YMM, ZMM};
+// registers 16 to 31 only have an EVEX encoding
+static constexpr std::array<const char *, 16> evex_reg_names[] = {
+	{"xmm16", "xmm17", "xmm18", "xmm19", "xmm20", "xmm21", "xmm22", "xmm23", "xmm24", "xmm25", "xmm26", "xmm27", "xmm28", "xmm29", "xmm30", "xmm31"},
+	{"ymm16", "ymm17", "ymm18", "ymm19", "ymm20", "ymm21", "ymm22", "ymm23", "ymm24", "ymm25", "ymm26", "ymm27", "ymm28", "ymm29", "ymm30", "ymm31"},
+	{"zmm16", "zmm17", "zmm18", "zmm19", "zmm20", "zmm21", "zmm22", "zmm23", "zmm24", "zmm25", "zmm26", "zmm27", "zmm28", "zmm29", "zmm30", "zmm31"},
+};
+static constexpr const char *high_regs[] = {"ah", "ch", "dh", "bh"};
+static constexpr const char *x87_regs[] = {"st0", "st1", "st2", "st3", "st4", "st5", "st6", "st7"};
+static constexpr const char *mask_regs[] = {"k0", "k1", "k2", "k3", "k4", "k5", "k6", "k7"};
+
+static constexpr size_t num_regs = (std::size(reg_names) + std::size(evex_reg_names)) * 16 + std::size(high_regs) + std::size(x87_regs) + std::size(mask_regs);
+static constexpr size_t max_reg_len = 5;
+static constexpr size_t reg_slot_bits = 12;
+
+static constexpr std::array<reg_entry, num_regs> make_regs() {
+	std::array<reg_entry, num_regs> regs;
+	size_t n = 0;
+	for (size_t i = 0; i < std::size(reg_names); i++)
+		for (short j = 0; j < 16; j++)
+			regs[n++] = {reg_names[i][j], {j, reg_sizes[i], reg_classes[i], j >= 8 || (reg_sizes[i] == 8 && j >= 4), false}};
+	for (size_t i = 0; i < std::size(evex_reg_names); i++)
+		for (short j = 0; j < 16; j++)
+			regs[n++] = {evex_reg_names[i][j], {(short)(j + 16), reg_sizes[i + 4], reg_classes[i + 4], false, false}};
+	for (short j = 0; j < 4; j++)
+		regs[n++] = {high_regs[j], {j, 8, GPR, false, true}};
+	for (short j = 0; j < 8; j++)
+		regs[n++] = {x87_regs[j], {j, 80, X87, false, false}};
+	for (short j = 0; j < 8; j++)
+		regs[n++] = {mask_regs[j], {j, 64, MASK, false, false}};
+	return regs;
+}
+
+static constexpr std::array<reg_entry, num_regs> regs = make_regs();
+
+static constexpr uint64_t reg_key(std::string_view s) {
+	uint64_t key = 0;
+	for (char c : s)
+		key = key << 8 | (unsigned char)c;
+	return key;
+}
+
+static constexpr size_t reg_slot(uint64_t key, uint64_t mul) {
+	return (key * mul) >> (64 - reg_slot_bits);
+}
+
+// odd multiplier that gives every register a slot of its own, the candidates are drawn from a
+// linear congruential generator since neighbouring multipliers collide on the same names
+static constexpr uint64_t find_reg_mul() {
+	for (uint64_t mul = 0x9e3779b97f4a7c15;; mul = (mul * 6364136223846793005u + 1442695040888963407u) | 1) {
+		std::array<bool, 1 << reg_slot_bits> used{};
+		bool ok = true;
+		for (size_t i = 0; i < num_regs && ok; i++) {
+			size_t slot = reg_slot(reg_key(regs[i].name), mul);
+			ok = !used[slot];
+			used[slot] = true;
+		}
+		if (ok)
+			return mul;
+	}
+}
+
+static constexpr uint64_t reg_mul = find_reg_mul();
+
+// index in regs + 1, 0 for an empty slot
+static constexpr std::array<uint8_t, 1 << reg_slot_bits> make_reg_slots() {
+	std::array<uint8_t, 1 << reg_slot_bits> slots{};
+	for (size_t i = 0; i < num_regs; i++)
+		slots[reg_slot(reg_key(regs[i].name), reg_mul)] = i + 1;
+	return slots;
+}
+
+static constexpr std::array<uint8_t, 1 << reg_slot_bits> reg_slots = make_reg_slots();
+
+reg_info find_reg(std::string_view s) {
+	if (s.empty() || s.size() > max_reg_len)
+		return {};
+	uint8_t i = reg_slots[reg_slot(reg_key(s), reg_mul)];
+	if (i == 0 || regs[i - 1].name != s)
+		return {};
+	return regs[i - 1].info;
+}
+
+// name of a general purpose register of the given number and size
+std::string_view reg_name(short num, short size) {
+	for (size_t i = 0; i < std::size(reg_sizes); i++)
+		if (reg_sizes[i] == size && reg_classes[i] == GPR)
+			return reg_names[i][num];
+	return {};
+}
+
 short reg_num(const std::string &s) {
-	auto ptr = _reg_num.find(s);
-	if (ptr == _reg_num.end())
-		return -1;
-	else
-		return ptr->second;
+	return find_reg(s).num;
 }
 
 short reg_size(const std::string &s) {
-	auto ptr = _reg_size.find(s);
-	if (ptr == _reg_size.end())
-		return -1;
-	else
-		return ptr->second;
+	return find_reg(s).size;
 }
 
 short mem_size(const std::string &s) {
@@ -33,6 +132,8 @@ short mem_size(const std::string &s) {
 		return 128;
 	if (s.starts_with("yword ") || s.starts_with("ymmword "))
 		return 256;
+	if (s.starts_with("zword ") || s.starts_with("zmmword "))
+		return 512;
 	return -1;
 }
 
@@ -54,18 +155,99 @@ op_type get_optype(const std::string &s) {
 	return IMM;
 }
 
+// anything that is not a register or a number is taken as a symbol, it may be defined later in the file
+bool is_symbol(const std::string &s) {
+	return !s.empty() && !isdigit(s[0]) && s[0] != '-' && s[0] != '+' && s[0] != '\'' && reg_size(s) == -1;
+}
+
+// local labels are relative to the last global label
+std::string symbol_name(const std::string &s) {
+	if (s[0] == '.')
+		return prev_label + s;
+	return s;
+}
+
+// integer literal with an optional sign: decimal, 0x hexadecimal, 0o octal, 0b binary or 'c' character,
+// negative values are returned in two's complement
+std::errc parse_number(std::string_view s, uint64_t &value) {
+	bool neg = false;
+	if (!s.empty() && (s[0] == '-' || s[0] == '+')) {
+		neg = s[0] == '-';
+		s.remove_prefix(1);
+	}
+	if (s.size() == 3 && s[0] == '\'' && s[2] == '\'') {
+		value = (unsigned char)s[1];
+	} else {
+		int base = 10;
+		if (s.size() > 2 && s[0] == '0') {
+			if (s[1] == 'x' || s[1] == 'X')
+				base = 16;
+			else if (s[1] == 'o' || s[1] == 'O')
+				base = 8;
+			else if (s[1] == 'b' || s[1] == 'B')
+				base = 2;
+			if (base != 10)
+				s.remove_prefix(2);
+		}
+		auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value, base);
+		if (ec != std::errc())
+			return ec;
+		if (s.empty() || ptr != s.data() + s.size())
+			return std::errc::invalid_argument;
+	}
+	if (neg) {
+		if (value > 1ull << 63)
+			return std::errc::result_out_of_range;
+		value = -value;
+	}
+	return std::errc();
+}
+
+// displacement of a memory operand
+static bool parse_disp(std::string_view s, int32_t &disp) {
+	uint64_t value;
+	std::errc ec = parse_number(s, value);
+	if (ec == std::errc::invalid_argument) {
+		error = "symbole « " + std::string(s) + " » non défini";
+		return false;
+	}
+	if (ec != std::errc() || (int64_t)value != (int32_t)value) {
+		error = "déplacement trop grand";
+		return false;
+	}
+	disp = value;
+	return true;
+}
+
+// xmm, ymm or zmm register, the index of a VSIB operand
+static bool is_vector_reg(const std::string &s) {
+	const reg_info r = find_reg(s);
+	return r.size != -1 && (r.type == XMM || r.type == YMM || r.type == ZMM);
+}
+
+// index of a symbol in symbols, it is added undefined the first time it is seen
+uint32_t intern(std::string_view name) {
+	auto it = symbol_ids.find(name);
+	if (it != symbol_ids.end())
+		return it->second;
+	symbols.emplace_back().name = name;
+	symbol_ids.emplace(symbols.back().name, symbols.size() - 1);
+	return symbols.size() - 1;
+}
+
 // this function will NOT handle invalid input properly
-mem_output *parse_mem(std::string in, short &size) {
-	if (reg_size(in) != -1) {
-		mem_output *out = new mem_output();
-		short s1 = reg_size(in);
-		short a1 = reg_num(in);
+bool parse_mem(std::string in, mem_output &out) {
+	const reg_info rm = find_reg(in);
+	if (rm.size != -1) {
+		out = mem_output();
+		short s1 = rm.size;
+		short a1 = rm.num + rm.high * 4;
 		if (s1 == 16)
-			out->prefix = 0x66;
-		if (a1 >= 8 || s1 == 64)
-			out->rex = 0x40 | ((s1 == 64) << 3) | (a1 >= 8);
-		out->rm = 0xc0 | (a1 & 7);
-		return out;
+			out.prefix = 0x66;
+		if (rm.rex || s1 == 64)
+			out.rex = 0x40 | ((s1 == 64) << 3) | (a1 >= 8);
+		out.rm = 0xc0 | (a1 & 7);
+		return true;
 	}
 	// off can be: label + num, label, num
 	// [reg + reg * scale + off] SIB
@@ -77,39 +259,25 @@ mem_output *parse_mem(std::string in, short &size) {
 	// [reg + off] NO SIB
 	// [reg] NO SIB
 	// [off] NO SIB
-	if (size == -1 || in[0] != '[') {
-		short tmp;
-		tmp = mem_size(in);
-		if (tmp == -1)
-			return nullptr;
-		size = tmp;
-		in = in.substr(5 + (tmp >= 32));
+	if (in[0] != '[') {
+		if (mem_size(in) == -1)
+			return false;
+		in = in.substr(in.find('['));
 	}
+	out = mem_output();
 	if (in.starts_with("[rel ")) {
-		mem_output *out = new mem_output();
-		out->rm = 0x05;
-		out->offsize = 32;
-		out->reloc.second = REL;
-		in = in.substr(5, in.size() - 6);
-		if (!labels.count(in)) {
-			error = "symbole « " + in + " » non défini";
-			return nullptr;
-		}
-		size_t op = in.find('+');
+		out.rm = 0x05;
+		out.offsize = 32;
+		out.reloc.second = REL;
+		std::string_view sym = std::string_view(in).substr(5, in.size() - 6);
+		size_t op = sym.find_first_of("+-");
 		if (op != std::string::npos) {
-			out->offset = std::stoi(in.substr(op + 1), 0, 0);
-			in = in.substr(0, op);
-		} else {
-			op = in.find('-');
-			if (op != std::string::npos) {
-				out->offset = -std::stoi(in.substr(op + 1), 0, 0);
-				in = in.substr(0, op);
-			} else {
-				out->offset = 0;
-			}
+			if (!parse_disp(sym.substr(op + (sym[op] == '+')), out.offset))
+				return false;
+			sym = sym.substr(0, op);
 		}
-		out->reloc.first = in;
-		return out;
+		out.reloc.first = intern(symbol_name(std::string(sym)));
+		return true;
 	}
 	in = in.substr(0, in.size() - 1);
 	std::vector<std::string> tokens;
@@ -124,11 +292,11 @@ mem_output *parse_mem(std::string in, short &size) {
 		r = std::min(in.find('*', l + 1), std::min(in.find('+', l + 1), in.find('-', l + 1)));
 	}
 	if (tokens.size() == 0)
-		return nullptr;
+		return false;
 
 	for (size_t i = 0; i < ops.size(); i++) {
 		if (ops[i] == '-') {
-			tokens[i + 1] = std::to_string(-std::stoi(tokens[i + 1]));
+			tokens[i + 1].insert(0, 1, '-');
 			ops[i] = '+';
 		}
 	}
@@ -150,32 +318,30 @@ mem_output *parse_mem(std::string in, short &size) {
 		}
 	}
 
-	mem_output *out = new mem_output();
-
 	// resolve labels and combine with imms if possible
-	if (tokens.size() > 1 && (data_labels.count(tokens[tokens.size() - 2]) || bss_labels.count(tokens[tokens.size() - 2]))) {
-		out->reloc.first = tokens[tokens.size() - 2];
-		out->reloc.second = ABS;
+	if (tokens.size() > 1 && is_symbol(tokens[tokens.size() - 2])) {
+		out.reloc.first = intern(symbol_name(tokens[tokens.size() - 2]));
+		out.reloc.second = ABS;
 		if (ops.back() != '+')
-			return nullptr;
+			return false;
 		tokens.erase(tokens.end() - 2);
 		ops.pop_back();
 	} else {
-		if (data_labels.count(tokens.front()) || bss_labels.count(tokens.front())) {
+		if (is_symbol(tokens.front())) {
 			tokens.push_back(tokens.front());
 			ops.push_back('+');
 			tokens.erase(tokens.begin());
 			ops.erase(ops.begin());
 		}
-		if (data_labels.count(tokens.back()) || bss_labels.count(tokens.back())) {
-			out->reloc.first = tokens.back();
-			out->reloc.second = ABS;
+		if (is_symbol(tokens.back())) {
+			out.reloc.first = intern(symbol_name(tokens.back()));
+			out.reloc.second = ABS;
 			tokens.back() = "0";
 		}
 	}
 
-	// check to see if we need to use SIB
-	if (tokens.size() == 1 || (reg_size(tokens[1]) == -1 && ops[0] == '+')) {
+	// check to see if we need to use SIB, a vector index always does
+	if ((tokens.size() == 1 || (reg_size(tokens[1]) == -1 && ops[0] == '+')) && !is_vector_reg(tokens[0])) {
 		// no sib
 		if (tokens.size() == 1) {
 			short a1 = reg_num(tokens[0]);
@@ -183,89 +349,90 @@ mem_output *parse_mem(std::string in, short &size) {
 				// register
 				// size override
 				if (reg_size(tokens[0]) == 32)
-					out->prefix = 0x67;
+					out.prefix = 0x67;
 				// rex prefix if necessary
 				if (a1 >= 8) {
-					out->rex = 0x41;
+					out.rex = 0x41;
 					// check for collisions with rip relative addressing
 					if (a1 == 13) {
-						out->rm = 0x45;
-						out->offsize = 8;
-						out->offset = 0x00;
-						return out;
+						out.rm = 0x45;
+						out.offsize = 8;
+						out.offset = 0x00;
+						return true;
 					}
 					// collisions with SIB addressing
 					if ((a1 & 7) == 0b100) {
-						out->rm = 0x04;
-						out->sib = 0b00100000 | (a1 & 7);
-						return out;
+						out.rm = 0x04;
+						out.sib = 0b00100000 | (a1 & 7);
+						return true;
 					}
 				}
 				// modrm
-				out->rm = ((a1 == 5) << 6) | (a1 & 7);
+				out.rm = ((a1 == 5) << 6) | (a1 & 7);
 				// cannot directly address bp, so we do it with an offset of 0
 				if (a1 == 5) {
-					out->offsize = 8;
-					out->offset = 0;
+					out.offsize = 8;
+					out.offset = 0;
 				} else if (a1 == 4) {
 					// we also cannot directly address sp, so we add a sib byte with no index
-					out->sib = 0x24;
+					out.sib = 0x24;
 				}
 			} else {
 				// only offset
-				out->rm = 0x04;
-				out->sib = 0b00100101;
-				out->offset = std::stoi(tokens[0], 0, 0);
-				out->offsize = 32;
-				if (out->reloc.second == NONE && (int8_t)out->offset == out->offset) {
-					out->offsize = 8;
-					if (out->rm & 0x80)
-						out->rm ^= 0xc0;
-				}
+				out.rm = 0x04;
+				out.sib = 0b00100101;
+				if (!parse_disp(tokens[0], out.offset))
+					return false;
+				// without a base the displacement is always 32 bits
+				out.offsize = 32;
 			}
 		} else {
 			// must be reg + offset
 			short a1 = reg_num(tokens[0]);
 			if (a1 == -1) {
 				error = "symbole « " + tokens[0] + " » non défini";
-				return nullptr;
+				return false;
 			}
 			// size override
 			if (reg_size(tokens[0]) == 32)
-				out->prefix = 0x67;
+				out.prefix = 0x67;
 			// rex prefix if necessary
 			if (a1 >= 8)
-				out->rex = 0x41;
+				out.rex = 0x41;
 			// modrm
-			out->rm = 0x80 | (a1 & 7);
+			out.rm = 0x80 | (a1 & 7);
 			if ((a1 & 7) == 4)
 				// we cannot directly address sp, so we add a sib byte with no index
-				out->sib = 0x24;
+				out.sib = 0x24;
 			// offset
-			out->offset = std::stoi(tokens[1], 0, 0);
-			out->offsize = 32;
-			if (out->reloc.second == NONE && (int8_t)out->offset == out->offset) {
-				out->offsize = 8;
-				if (out->rm & 0x80)
-					out->rm ^= 0xc0;
+			if (!parse_disp(tokens[1], out.offset))
+				return false;
+			out.offsize = 32;
+			if (out.reloc.second == NONE && (out.rm & 0x80) && (int8_t)out.offset == out.offset) {
+				out.offsize = 8;
+				out.rm ^= 0xc0;
 			}
 		}
 	} else {
 		// sib
 		short base;
 		short index;
-		short scale;
-		int offset;
+		int32_t scale;
+		int32_t offset;
 		bool force = false;
-		if (ops[0] != '*') {
+		// the vector register of a VSIB operand is the index, wherever it is written
+		if (tokens.size() > 1 && ops[0] == '+' && is_vector_reg(tokens[0]) && find_reg(tokens[1]).type == GPR)
+			std::swap(tokens[0], tokens[1]);
+		if (!ops.empty() && ops[0] != '*' && !is_vector_reg(tokens[0])) {
 			base = reg_num(tokens[0]);
 			tokens.erase(tokens.begin());
 			ops.erase(ops.begin());
 		} else
 			base = -1;
 		if (ops.size() && ops.back() != '*' && reg_size(tokens.back()) == -1) {
-			offset = std::stoi(tokens.back(), 0, 0);
-			if (out->reloc.second != NONE)
+			if (!parse_disp(tokens.back(), offset))
+				return false;
+			if (out.reloc.second != NONE)
 				force = true;
 			tokens.pop_back();
 			ops.pop_back();
@@ -279,9 +446,10 @@ mem_output *parse_mem(std::string in, short &size) {
 			scale = 1;
 		} else if (tokens.size() == 2) {
 			index = reg_num(tokens[0]);
-			scale = std::stoi(tokens[1]);
+			if (!parse_disp(tokens[1], scale))
+				return false;
 		} else
-			return nullptr;
+			return false;
 		if (scale == 1)
 			scale = 0;
 		else if (scale == 2)
@@ -291,111 +459,123 @@ mem_output *parse_mem(std::string in, short &size) {
 		else if (scale == 8)
 			scale = 3;
 		else
-			return nullptr;
-		if (index == 4) {
+			return false;
+		if (!tokens.empty() && is_vector_reg(tokens[0])) {
+			out.vsib = reg_size(tokens[0]);
+			out.vsib_index = index;
+		} else if (index == 4) {
 			error = "erreur : impossible d'utiliser sp comme un index";
-			return nullptr;
+			return false;
 		}
 		// size override
 		if (reg_size(tokens[0]) == 32)
-			out->prefix = 0x67;
+			out.prefix = 0x67;
 		// rex prefix if necessary
-		if (base >= 8 || index >= 8)
-			out->rex = 0x40 | ((index >= 8) << 1) | (base >= 8);
-		if ((base & 7) == 5)
+		const bool index_x = index != -1 && (index & 8);
+		if (base >= 8 || index_x)
+			out.rex = 0x40 | (index_x << 1) | (base >= 8);
+		// rbp and r13 need a displacement, and without a base it is always 32 bits
+		if ((base & 7) == 5 || base == -1)
 			force = true;
 		// modrm
-		out->rm = 0x04 | ((offset || force) << 7);
+		out.rm = 0x04 | ((offset || force) << 7);
 		// 5 means no base
 		if (base == -1) {
 			base = 5;
-			out->rm &= ~0xc0;
+			out.rm &= ~0xc0;
 		}
 		// 4 means no index
 		if (index == -1) {
 			index = 4;
-			out->rm &= ~0xc0;
+			out.rm &= ~0xc0;
 		}
 		// sib
-		out->sib = (scale << 6) | ((index & 7) << 3) | (base & 7);
+		out.sib = (scale << 6) | ((index & 7) << 3) | (base & 7);
 		// offset
 		if (offset || force) {
-			out->offset = offset;
-			out->offsize = 32;
-			if (out->reloc.second == NONE && (int8_t)offset == offset) {
-				out->offsize = 8;
-				if (out->rm & 0x80)
-					out->rm ^= 0xc0;
+			out.offset = offset;
+			out.offsize = 32;
+			if (out.reloc.second == NONE && (out.rm & 0x80) && (int8_t)offset == offset) {
+				out.offsize = 8;
+				out.rm ^= 0xc0;
 			}
 		}
 	}
-	return out;
+	return true;
 }
 
-std::pair<unsigned long long, short> parse_imm(std::string s) {
-	// if label, return label
-	if (s[0] == '.')
-		s = prev_label + s;
-	if (s.ends_with(" wrt ..plt")) {
-		if (!extern_labels_map.count(s.substr(0, s.size() - 10))) {
-			error = "symbole « " + s.substr(0, s.size() - 10) + " » non défini";
-			return {0, -1};
+std::pair<unsigned long long, short> parse_imm(const std::string &arg) {
+	if (is_symbol(arg)) {
+		const std::string s = symbol_name(arg);
+		if (s.ends_with(" wrt ..plt")) {
+			const uint32_t id = intern(std::string_view(s).substr(0, s.size() - 10));
+			if (!symbols[id].external) {
+				error = "symbole « " + symbols[id].name + " » non défini";
+				return {0, -1};
+			}
+			return {id, -4};
 		}
-		return {0, -4};
+		const uint32_t id = intern(s);
+		if (symbols[id].section == TEXT)
+			return {id, -3};
+		if (symbols[id].external)
+			return {id, -5};
+		if (symbols[id].section != UNDEF)
+			return {id, -2};
+		// not defined yet
+		return {id, -6};
 	}
-	if (text_labels_map.count(s))
-		return {text_labels_map.at(s), -3};
-	if (extern_labels_map.count(s))
-		return {extern_labels_map.at(s), -5};
-	if (labels.count(s))
-		return {0, -2};
+	const std::string &s = arg;
 	// if character, return character
-	if (s[0] == '\'') {
-		if (s[2] != '\'') {
-			error = "charactère invalide";
-			return {0, -1};
-		}
-		return {(unsigned char)s[1], 8};
+	if (s[0] == '\'' && (s.size() != 3 || s[2] != '\'')) {
+		error = "charactère invalide";
+		return {0, -1};
 	}
-	// detect base
-	int base = 0;
-	if (s.starts_with("0x"))
-		base = 16;
-	else if (s.starts_with("0b"))
-		base = 2;
-	else
-		base = 10;
-	if (base != 10)
-		s = s.substr(2);
-	// parse
-	bool neg = s[0] == '-';
-	try {
-		if (neg) {
-			int64_t val = std::stoll(s, nullptr, base);
-			short size = 64;
-			if ((int8_t)val == val)
-				size = 8;
-			else if ((int16_t)val == val)
-				size = 16;
-			else if ((int32_t)val == val)
-				size = 32;
-			return {val, size};
-		} else {
-			uint64_t val = std::stoull(s, nullptr, base);
-			short size = 64;
-			if ((val & 0xffffffffffffff00) == 0)
-				size = 8;
-			else if ((val & 0xffffffffffff0000) == 0)
-				size = 16;
-			else if ((val & 0xffffffff00000000) == 0)
-				size = 32;
-			return {val, size};
-		}
-	} catch (std::invalid_argument const &) {
+	uint64_t val;
+	std::errc ec = parse_number(s, val);
+	if (ec == std::errc::invalid_argument) {
 		error = "symbole « " + s + " » non défini";
 		return {0, -1};
-	} catch (std::out_of_range const &) {
+	} else if (ec != std::errc()) {
 		error = "valeur d'immédiate trop grande";
 		return {0, -1};
 	}
+	short size = 64;
+	if (s[0] == '-') {
+		if ((int8_t)val == (int64_t)val)
+			size = 8;
+		else if ((int16_t)val == (int64_t)val)
+			size = 16;
+		else if ((int32_t)val == (int64_t)val)
+			size = 32;
+	} else {
+		if ((val & 0xffffffffffffff00) == 0)
+			size = 8;
+		else if ((val & 0xffffffffffff0000) == 0)
+			size = 16;
+		else if ((val & 0xffffffff00000000) == 0)
+			size = 32;
+	}
+	return {val, size};
+}
+
+// the operand is parsed once, the encodings of the instruction share it
+operand parse_operand(const std::string &s) {
+	operand op;
+	op.type = get_optype(s);
+	if (op.type == REG) {
+		op.reg = find_reg(s);
+		op.size = op.reg.size;
+		parse_mem(s, op.mem);
+	} else if (op.type == MEM) {
+		op.size = mem_size(s);
+		if (!parse_mem(s, op.mem)) {
+			if (error.empty())
+				error = "mode d'adressage invalide";
+			op.type = INVALID;
+		}
+	} else if (op.type == IMM) {
+		op.imm = parse_imm(s);
+	}
+	return op;
 }
@@ -5,17 +5,21 @@
 #include "defines.hpp"
 
 extern std::string prev_label;
-extern std::unordered_map<std::string, uint64_t> data_labels;
-extern std::unordered_map<std::string, uint64_t> bss_labels;
-extern std::unordered_map<std::string, size_t> extern_labels_map;
-extern std::unordered_map<std::string, size_t> text_labels_map;
-extern std::unordered_map<std::string, std::pair<sect, size_t>> labels;
+extern std::deque<symbol> symbols;
+extern std::unordered_map<std::string_view, uint32_t> symbol_ids;
 
+reg_info find_reg(std::string_view);
+std::string_view reg_name(short, short);
 short reg_num(const std::string &);
 short reg_size(const std::string &);
 short mem_size(const std::string &);
 op_type get_optype(const std::string &);
-mem_output *parse_mem(std::string, short &);
-std::pair<unsigned long long, short> parse_imm(std::string);
+bool is_symbol(const std::string &);
+std::string symbol_name(const std::string &);
+uint32_t intern(std::string_view);
+bool parse_mem(std::string, mem_output &);
+std::errc parse_number(std::string_view, uint64_t &);
+std::pair<unsigned long long, short> parse_imm(const std::string &);
+operand parse_operand(const std::string &);
 
 #endif
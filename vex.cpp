@@ -1,112 +1,61 @@
 #include "vex.hpp"
-#include "vex.dat"
 
-void handle_vex(std::string &s, std::vector<std::string> &args, const size_t linenum, const bool prefix) {
+void handle_vex(const std::string &s, const std::vector<operand> &ops, const size_t linenum, const bool prefix, const std::span<const instr_record> records) {
 	error = "";
-	char *l = vex_map;
-	char *r = vex_map + vex_map_size - 1;
-	// go to the start of the section
-	while (r[-1] != '\n' || r[-2] != '\n')
-		r--;
-	// binary search for the section that matches
-	while (l < r && l < vex_map + vex_map_size - 2 && r > vex_map + 2) {
-		char *m = l + (r - l) / 2;
-		while (m >= vex_map + 2 && (m[-1] != '\n' || m[-2] != '\n'))
-			m--;
-		if (strncmp(m, s.c_str(), s.size()) == 0 && m[s.size()] == ' ') {
-			l = m;
-			break;
-		} else if (strncmp(m, s.c_str(), s.size()) < 0) {
-			l = m + 6;
-			while (l <= vex_map + vex_map_size - 2 && (l[-1] != '\n' || l[-2] != '\n'))
-				l++;
-		} else {
-			r = m - 6;
-			while (r >= vex_map + 2 && (r[-1] != '\n' || r[-2] != '\n'))
-				r--;
-		}
-	}
-	// store all lines that match
-	while ((strncmp(l, s.c_str(), s.size()) != 0 || l[s.size()] != ' ') && l < vex_map + vex_map_size)
-		l++;
-	if (l >= vex_map + vex_map_size - 1 || *(l - 1) != '\n')
-		cerr(linenum, "instruction inconnue « " + s + " »");
 	if (prefix)
 		cerr(linenum, "impossible d'utiliser un préfixe avec une instruction VEX");
-	r = std::find(l + 1, vex_map + vex_map_size, '\n');
-	std::vector<std::string> matches;
-	while (*l != '\n' && r != vex_map + vex_map_size) {
-		matches.emplace_back(l, r);
-		l = r + 1;
-		r = std::find(l, vex_map + vex_map_size, '\n');
-	}
 	std::vector<std::pair<enum op_type, short>> types;
-	for (const std::string &arg : args) {
-		enum op_type type = get_optype(arg);
-		if (type == REG) {
-			types.emplace_back(REG, reg_size(arg));
-		} else if (type == MEM) {
-			types.emplace_back(MEM, mem_size(arg));
-		} else if (type == IMM) {
-			auto tmp = parse_imm(arg);
+	for (const operand &op : ops) {
+		if (op.type == REG) {
+			types.emplace_back(REG, op.size);
+		} else if (op.type == MEM) {
+			types.emplace_back(MEM, op.size);
+		} else if (op.type == IMM) {
+			const auto &tmp = op.imm;
 			if (tmp.second == -1) {
 				cerr(linenum, error);
-			} else if (tmp.second == -3) {
-				if (reloc_table.count(text_labels[tmp.first])) {
-					int32_t off = reloc_table.at(text_labels.at(tmp.first)) - text_buffer.size() - 3;
-					if ((int8_t)off == off) {
-						types.emplace_back(IMM, 8);
-					} else {
-						types.emplace_back(IMM, 32);
-						tmp.first = 0;
-					}
-				} else {
-					types.emplace_back(IMM, 32);
-					tmp.first = 0;
-				}
-			} else if (tmp.second == -2 || tmp.second == -4) {
+			} else if (tmp.second <= -2) {
+				uses_symbol = true;
 				types.emplace_back(IMM, 32);
 			} else {
 				types.emplace_back(IMM, tmp.second);
 			}
-		} else {
-			cerr(linenum, "opérande invalide « " + arg + " »");
 		}
 	}
-	std::vector<std::pair<std::vector<std::string>, short>> valid;
-	for (size_t i = 0; i < matches.size(); i++) {
-		std::string &line = matches[i];
-		std::vector<std::string> tokens;
-		size_t l = 0;
-		size_t r = line.find(' ');
-		while (r != std::string::npos) {
-			tokens.push_back(line.substr(l, r - l));
-			l = r + 1;
-			r = line.find(' ', l);
-		}
-		tokens.push_back(line.substr(l));
-		if (tokens.size() != args.size() + 2)
+	std::vector<std::pair<instr_record, short>> valid;
+	for (const instr_record &record : records) {
+		if (record.num_operands != ops.size())
 			continue;
 		bool matched = true;
 		short size = 0;
-		for (size_t j = 0; j < args.size(); j++) {
-			std::string &token = tokens[j + 1];
-			if (token[0] == 'R') {
+		for (size_t j = 0; j < ops.size(); j++) {
+			const operand_pattern &op = record.operands[j];
+			// opmasks only match K, and registers 16 to 31 need an EVEX prefix
+			if (types[j].first == REG && ((op.letter == 'K') != (ops[j].reg.type == MASK) || ops[j].reg.num >= 16)) {
+				matched = false;
+				break;
+			}
+			if (op.kind == 'R') {
 				if (types[j].first != REG) {
 					matched = false;
 					break;
 				}
-				if (types[j].second != _sizes[token[1] - 'A']) {
+				if (types[j].second != op.size) {
 					matched = false;
 					break;
 				}
-				size += _sizes[token[1] - 'A'];
-			} else if (token[0] == 'M') {
-				if (types[j].first != MEM && types[j].first != REG) {
+				size += op.size;
+			} else if (op.kind == 'V') {
+				if (types[j].first != MEM || ops[j].mem.vsib != op.size) {
 					matched = false;
 					break;
 				}
-				if (token[1] == '*') {
+			} else if (op.kind == 'M') {
+				if ((types[j].first != MEM && types[j].first != REG) || (types[j].first == MEM && ops[j].mem.vsib)) {
+					matched = false;
+					break;
+				}
+				if (op.letter == '*') {
 					if (types[j].first != MEM) {
 						matched = false;
 						break;
@@ -114,30 +63,28 @@ void handle_vex(std::string &s, std::vector<std::string> &args, const size_t lin
 						continue;
 					}
 				}
-				if (types[j].second != -1 && types[j].second != _sizes[token[1] - 'A']) {
+				if (types[j].second != -1 && types[j].second != op.size) {
 					matched = false;
 					break;
 				}
-				size += _sizes[token[1] - 'A'];
-			} else if (token[0] == 'I') {
+				size += op.size;
+			} else if (op.kind == 'I') {
 				if (types[j].first != IMM) {
 					matched = false;
 					break;
 				}
-				if (types[j].second > _sizes[token[1] - 'A']) {
+				if (types[j].second > op.size) {
 					matched = false;
 					break;
 				}
-			} else {
-				std::cerr << "Erreur : ensemble d'instructions mal configurée" << std::endl;
 			}
 		}
 		if (matched) {
-			for (size_t j = 0; j < args.size(); j++) {
+			for (size_t j = 0; j < ops.size(); j++) {
 				if (types[j].second == -1)
-					types[j].second = _sizes[tokens[j + 1][1] - 'A'];
+					types[j].second = record.operands[j].size;
 			}
-			valid.emplace_back(tokens, size);
+			valid.emplace_back(record, size);
 		}
 	}
 	if (valid.empty())
@@ -146,22 +93,20 @@ void handle_vex(std::string &s, std::vector<std::string> &args, const size_t lin
 		if (valid[i].second != valid[i - 1].second)
 			cerr(linenum, "taille d'opération non spécifiée");
 	}
-	std::string best = "";
-	size_t bestlen = -1;
-	std::vector<reloc_entry> bestreloc;
-	for (auto &p : valid) {
-		std::vector<reloc_entry> reloc;
-		std::string tmp = "";
-		// parse vex prefix
-		std::string vex = p.first.back();
-		short l = vex[0] - '0';
-		short pp = vex[2] - '0';
-		short mmmmm = vex[4] - '0';
-		short w = vex[6] - '0';
+	instr_bytes best;
+	best.size = instr_bytes::max_size + 1;
+	for (const auto &match : valid) {
+		const instr_record &p = match.first;
+		instr_bytes tmp;
+		const std::string_view opcode((const char *)p.opcode.data(), p.opcode_size);
+		const short l = p.l;
+		const short pp = p.pp;
+		const short mmmmm = p.mmmmm;
+		const short w = p.w;
 		short rxb = 0;
 		short vvvv = 0;
-		if (args.size() == 0) {
-			if ((rxb & 0b11) == 0 && mmmmm == 0 && w == 0) {
+		if (ops.size() == 0) {
+			if ((rxb & 0b11) == 0 && mmmmm == 1 && w == 0) {
 				tmp += (unsigned char)0xc5;
 				tmp += (l << 2) | pp;
 				tmp.back() ^= 0xf8;
@@ -172,23 +117,16 @@ void handle_vex(std::string &s, std::vector<std::string> &args, const size_t lin
 				tmp += (w << 7) | (l << 2) | pp;
 				tmp.back() ^= 0x78;
 			}
-			for (size_t i = 8; i < p.first.back().size(); i += 2)
-				tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
+			tmp += opcode;
 		}
-		if (args.size() == 1) {
-			short s1 = _sizes[p.first[1][1] - 'A'];
-			mem_output *data = parse_mem(args[0], s1);
-			if (data == nullptr) {
-				if (error.empty())
-					error = "mode d'adressage invalide";
-				cerr(linenum, error);
-			}
-			if (data->prefix)
-				tmp += data->prefix;
-			if (data->rex)
-				rxb = data->rex ^ 0x40;
+		if (ops.size() == 1) {
+			mem_output data = ops[0].mem;
+			if (data.prefix)
+				tmp += data.prefix;
+			if (data.rex)
+				rxb = data.rex ^ 0x40;
 
-			if ((rxb & 0b11) == 0 && mmmmm == 0 && w == 0) {
+			if ((rxb & 0b11) == 0 && mmmmm == 1 && w == 0) {
 				tmp += (unsigned char)0xc5;
 				tmp += (rxb << 5) | (l << 2) | pp;
 				tmp.back() ^= 0xf8;
@@ -199,54 +137,42 @@ void handle_vex(std::string &s, std::vector<std::string> &args, const size_t lin
 				tmp += (w << 7) | (l << 2) | pp;
 				tmp.back() ^= 0x78;
 			}
-			short reg = 0;
-			for (size_t i = 8; i < p.first.back().size(); i += 2) {
-				if (p.first.back()[i] == '/') {
-					reg = std::stoi(p.first.back().substr(i + 1, 1), nullptr, 16);
-					break;
-				}
-				tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-			}
-			tmp += (uint8_t)data->rm | (reg << 3);
-			if (data->sib != 0x7fff)
-				tmp += data->sib;
+			const short reg = p.digit == -1 ? 0 : p.digit;
+			tmp += opcode;
+			tmp += (uint8_t)data.rm | (reg << 3);
+			if (data.sib != 0x7fff)
+				tmp += data.sib;
 
-			if (data->reloc.second != NONE) {
-				reloc.emplace_back(text_buffer.size() + tmp.size(), data->offset, data->reloc.second, data->reloc.first, 32);
-				data->offset = 0;
+			if (data.reloc.second != NONE) {
+				tmp.relocate({text_buffer.size() + tmp.size, data.offset, data.reloc.second, data.reloc.first, 32});
+				data.offset = 0;
 			}
 
-			for (int i = 0; i < data->offsize; i += 8)
-				tmp += (data->offset >> i) & 0xff;
-		} else if (args.size() == 2) {
+			for (int i = 0; i < data.offsize; i += 8)
+				tmp += (data.offset >> i) & 0xff;
+		} else if (ops.size() == 2) {
 			short reg = 0x7fff;
-			short mem_i = p.first[1][0] == 'M' ? 1 : 2;
+			short mem_i = p.operands[0].kind == 'M' ? 1 : 2;
 			short reg_i = mem_i == 1 ? 2 : 1;
-			short s1 = _sizes[p.first[mem_i][1] - 'A'];
-			mem_output *data = parse_mem(args[mem_i - 1], s1);
-			if (data == nullptr) {
-				if (error.empty())
-					error = "mode d'adressage invalide";
-				cerr(linenum, error);
-			}
-			if (data->prefix)
-				tmp += data->prefix;
-			if (data->rex)
-				rxb = data->rex ^ 0x40;
-			if (p.first.back()[p.first.back().size() - 2] == '/')
-				reg = std::stoi(p.first.back().substr(p.first.back().size() - 1, 1), nullptr, 16);
+			mem_output data = ops[mem_i - 1].mem;
+			if (data.prefix)
+				tmp += data.prefix;
+			if (data.rex)
+				rxb = data.rex ^ 0x40;
+			if (p.digit != -1)
+				reg = p.digit;
 
 			if (reg != 0x7fff)
-				vvvv = reg_num(args[reg_i - 1]);
+				vvvv = ops[reg_i - 1].reg.num;
 			else
-				reg = reg_num(args[reg_i - 1]);
+				reg = ops[reg_i - 1].reg.num;
 
 			if (reg >= 8) {
 				rxb |= 0b100;
 				reg ^= 8;
 			}
 
-			if ((rxb & 0b11) == 0 && mmmmm == 0 && w == 0) {
+			if ((rxb & 0b11) == 0 && mmmmm == 1 && w == 0) {
 				tmp += (unsigned char)0xc5;
 				tmp += (rxb << 5) | (vvvv << 3) | (l << 2) | pp;
 				tmp.back() ^= 0xf8;
@@ -258,30 +184,56 @@ void handle_vex(std::string &s, std::vector<std::string> &args, const size_t lin
 				tmp.back() ^= 0x78;
 			}
 
-			for (size_t i = 8; i < p.first.back().size(); i += 2) {
-				if (p.first.back()[i] == '/')
-					break;
-				tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
+			tmp += opcode;
+			tmp += (uint8_t)data.rm | (reg << 3);
+			if (data.sib != 0x7fff)
+				tmp += data.sib;
+
+			if (data.reloc.second != NONE) {
+				tmp.relocate({text_buffer.size() + tmp.size, data.offset, data.reloc.second, data.reloc.first, 32});
+				data.offset = 0;
+			}
+
+			for (int i = 0; i < data.offsize; i += 8)
+				tmp += (data.offset >> i) & 0xff;
+		} else if (ops.size() == 3 && p.operands[1].kind == 'V') {
+			// gather: reg, VSIB memory, vvvv is the mask
+			short reg = ops[0].reg.num;
+			mem_output data = ops[1].mem;
+			vvvv = ops[2].reg.num;
+			if (reg == vvvv || reg == data.vsib_index || vvvv == data.vsib_index)
+				cerr(linenum, "la destination, l'index et le masque doivent être différents");
+			if (data.prefix)
+				tmp += data.prefix;
+			rxb = data.rex & 0b11;
+			if (reg >= 8) {
+				reg &= 7;
+				rxb |= 0b100;
 			}
-			tmp += (uint8_t)data->rm | (reg << 3);
-			if (data->sib != 0x7fff)
-				tmp += data->sib;
+			tmp += (unsigned char)0xc4;
+			tmp += (rxb << 5) | mmmmm;
+			tmp.back() ^= 0xe0;
+			tmp += (w << 7) | (vvvv << 3) | (l << 2) | pp;
+			tmp.back() ^= 0x78;
+			tmp += opcode;
+			tmp += (reg << 3) | data.rm;
+			tmp += data.sib;
 
-			if (data->reloc.second != NONE) {
-				reloc.emplace_back(text_buffer.size() + tmp.size(), data->offset, data->reloc.second, data->reloc.first, 32);
-				data->offset = 0;
+			if (data.reloc.second != NONE) {
+				tmp.relocate({text_buffer.size() + tmp.size, data.offset, data.reloc.second, data.reloc.first, 32});
+				data.offset = 0;
 			}
 
-			for (int i = 0; i < data->offsize; i += 8)
-				tmp += (data->offset >> i) & 0xff;
-		} else if (args.size() == 3 || args.size() == 4) {
-			if (p.first[3][0] == 'I' && (s.starts_with("vpsl") || s.starts_with("vpsr"))) {
+			for (int i = 0; i < data.offsize; i += 8)
+				tmp += (data.offset >> i) & 0xff;
+		} else if (ops.size() == 3 || ops.size() == 4) {
+			if (p.operands[2].kind == 'I' && (s.starts_with("vpsl") || s.starts_with("vpsr"))) {
 				// special case: vvvv, r/m, imm
-				vvvv = reg_num(args[0]);
-				short rm = reg_num(args[1]);
+				vvvv = ops[0].reg.num;
+				short rm = ops[1].reg.num;
 				rxb = rm >= 8;
 
-				if ((rxb & 0b11) == 0 && mmmmm == 0 && w == 0) {
+				if ((rxb & 0b11) == 0 && mmmmm == 1 && w == 0) {
 					tmp += (unsigned char)0xc5;
 					tmp += (rxb << 5) | (vvvv << 3) | (l << 2) | pp;
 					tmp.back() ^= 0xf8;
@@ -293,35 +245,24 @@ void handle_vex(std::string &s, std::vector<std::string> &args, const size_t lin
 					tmp.back() ^= 0x78;
 				}
 
-				short reg = 0;
-				for (size_t i = 8; i < p.first.back().size(); i += 2) {
-					if (p.first.back()[i] == '/') {
-						reg = std::stoi(p.first.back().substr(i + 1, 1), nullptr, 16);
-						break;
-					}
-					tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-				}
+				const short reg = p.digit == -1 ? 0 : p.digit;
+				tmp += opcode;
 				tmp += 0xc0 | (reg << 3) | (rm & 7);
-				tmp += std::stoi(args[2], nullptr, 0);
+				tmp += ops[2].imm.first;
 			} else {
-				if (p.first[3][0] == 'I') {
-					// reg, rm, imm
-					short reg = reg_num(args[0]);
-					short s1 = _sizes[p.first[2][1] - 'A'];
-					mem_output *data = parse_mem(args[1], s1);
-					if (data == nullptr) {
-						if (error.empty())
-							error = "mode d'addressage invalide";
-						cerr(linenum, error);
-					}
-					if (data->prefix)
-						tmp += data->prefix;
-					rxb = data->rex & 0x0f;
+				if (p.operands[2].kind == 'I') {
+					// reg, rm, imm or rm, reg, imm
+					const short mem_i = p.operands[0].kind == 'M' ? 0 : 1;
+					short reg = ops[1 - mem_i].reg.num;
+					mem_output data = ops[mem_i].mem;
+					if (data.prefix)
+						tmp += data.prefix;
+					rxb = data.rex & 0x0f;
 					if (reg >= 8) {
 						reg &= 7;
 						rxb |= 0b100;
 					}
-					if (!(rxb & 0b011) && !w && !mmmmm) {
+					if (!(rxb & 0b011) && !w && mmmmm == 1) {
 						// short form
 						tmp += (unsigned char)0xc5;
 						tmp += (rxb << 5) | (l << 2) | pp;
@@ -333,47 +274,40 @@ void handle_vex(std::string &s, std::vector<std::string> &args, const size_t lin
 						tmp += (w << 7) | (l << 2) | pp;
 						tmp.back() ^= 0x78;
 					}
-					for (size_t i = 8; i < p.first.back().size(); i += 2)
-						tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-					tmp += (reg << 3) | data->rm;
-					if (data->sib != 0x7fff)
-						tmp += data->sib;
+					tmp += opcode;
+					tmp += (reg << 3) | data.rm;
+					if (data.sib != 0x7fff)
+						tmp += data.sib;
 
-					if (data->reloc.second != NONE) {
-						reloc.emplace_back(text_buffer.size() + tmp.size(), data->offset, data->reloc.second, data->reloc.first, 32);
-						data->offset = 0;
+					if (data.reloc.second != NONE) {
+						tmp.relocate({text_buffer.size() + tmp.size, data.offset, data.reloc.second, data.reloc.first, 32});
+						data.offset = 0;
 					}
 
-					for (int i = 0; i < data->offsize; i += 8)
-						tmp += (data->offset >> i) & 0xff;
+					for (int i = 0; i < data.offsize; i += 8)
+						tmp += (data.offset >> i) & 0xff;
 
-					auto a3 = parse_imm(args[2]);
-					for (int i = 0; i < _sizes[p.first[3][1] - 'A']; i += 8)
+					auto a3 = ops[2].imm;
+					for (int i = 0; i < p.operands[2].size; i += 8)
 						tmp += (a3.first >> i) & 0xff;
 				} else {
 					short reg = 0x7fff;
-					short mem_i = p.first[1][0] == 'M' ? 1 : 3;
+					short mem_i = p.operands[0].kind == 'M' ? 1 : 3;
 					short reg_i = mem_i == 1 ? 3 : 1;
-					short s1 = _sizes[p.first[mem_i][1] - 'A'];
-					mem_output *data = parse_mem(args[mem_i - 1], s1);
-					if (data == nullptr) {
-						if (error.empty())
-							error = "mode d'adressage invalide";
-						cerr(linenum, error);
-					}
-					if (data->prefix)
-						tmp += data->prefix;
-					if (data->rex)
-						rxb = data->rex ^ 0x40;
+					mem_output data = ops[mem_i - 1].mem;
+					if (data.prefix)
+						tmp += data.prefix;
+					if (data.rex)
+						rxb = data.rex ^ 0x40;
 
-					vvvv = reg_num(args[1]);
-					reg = reg_num(args[reg_i - 1]);
+					vvvv = ops[1].reg.num;
+					reg = ops[reg_i - 1].reg.num;
 					if (reg >= 8) {
 						rxb |= 0b100;
 						reg ^= 8;
 					}
 
-					if (!(rxb & 0b11) && !mmmmm && !w) {
+					if (!(rxb & 0b11) && mmmmm == 1 && !w) {
 						tmp += (unsigned char)0xc5;
 						tmp += (rxb << 5) | (vvvv << 3) | (l << 2) | pp;
 						tmp.back() ^= 0xf8;
@@ -385,48 +319,37 @@ void handle_vex(std::string &s, std::vector<std::string> &args, const size_t lin
 						tmp.back() ^= 0x78;
 					}
 
-					for (size_t i = 8; i < p.first.back().size(); i += 2) {
-						if (p.first.back()[i] == '/')
-							break;
-						tmp += std::stoi(p.first.back().substr(i, 2), nullptr, 16);
-					}
-					tmp += (reg << 3) | data->rm;
-					if (data->sib != 0x7fff)
-						tmp += data->sib;
+					tmp += opcode;
+					tmp += (reg << 3) | data.rm;
+					if (data.sib != 0x7fff)
+						tmp += data.sib;
 
-					if (data->reloc.second != NONE) {
-						reloc.emplace_back(text_buffer.size() + tmp.size(), data->offset, data->reloc.second, data->reloc.first, 32);
-						data->offset = 0;
+					if (data.reloc.second != NONE) {
+						tmp.relocate({text_buffer.size() + tmp.size, data.offset, data.reloc.second, data.reloc.first, 32});
+						data.offset = 0;
 					}
 
-					for (int i = 0; i < data->offsize; i += 8)
-						tmp += (data->offset >> i) & 0xff;
+					for (int i = 0; i < data.offsize; i += 8)
+						tmp += (data.offset >> i) & 0xff;
 
-					if (args.size() == 4) {
+					if (ops.size() == 4) {
 						std::pair<short, short> a4;
 						if (types[3].first == IMM)
-							a4 = {parse_imm(args[3]).first, _sizes[p.first[4][1] - 'A']};
+							a4 = {ops[3].imm.first, p.operands[3].size};
 						else
-							a4 = {reg_num(args[3]) << 4, 8};
+							a4 = {ops[3].reg.num << 4, 8};
 						for (int i = 0; i < a4.second; i += 8)
 							tmp += (a4.first >> i) & 0xff;
 					}
 				}
 			}
 		}
-		if (tmp.size() <= bestlen) {
+		if (tmp.size <= instr_bytes::max_size && tmp.size <= best.size)
 			best = tmp;
-			bestlen = tmp.size();
-			bestreloc = reloc;
-		}
-		if (bestlen == 1)
+		if (best.size == 1)
 			break;
 	}
-	for (auto reloc : bestreloc) {
-		if (reloc.type != ABS)
-			reloc.addend -= best.size() - (reloc.offset - text_buffer.size());
-		relocations.push_back(reloc);
-	}
-	for (size_t i = 0; i < best.size(); i++)
-		text_buffer.push_back(best[i]);
+	if (best.size > instr_bytes::max_size)
+		cerr(linenum, "instruction trop longue");
+	emit_instr(best, linenum);
 }
@@ -4,16 +4,16 @@
 
 #include "defines.hpp"
 #include "utility.hpp"
+#include "table.hpp"
 
 extern void cerr(const int i, const std::string &s);
 
-extern std::vector<std::string> text_labels;
-extern std::unordered_map<std::string, size_t> text_labels_map;
 extern std::string text_buffer;
-extern std::vector<reloc_entry> relocations;
-extern std::unordered_map<std::string, uint64_t> reloc_table;
 extern std::string error;
+extern bool uses_symbol;
 
-void handle_vex(std::string &, std::vector<std::string> &, const size_t, const bool);
+void add_reloc(const reloc_entry &, const size_t);
+void emit_instr(const instr_bytes &, const size_t);
+void handle_vex(const std::string &, const std::vector<operand> &, const size_t, const bool, const std::span<const instr_record>);
 
 #endif